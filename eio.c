@@ -228,8 +228,8 @@ static void eio_destroy (eio_req *req);
 
   #define DT_DIR EIO_DT_DIR
   #define DT_REG EIO_DT_REG
-  #define D_NAME(entp) entp.cFileName
-  #define D_TYPE(entp) (entp.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY ? DT_DIR : DT_REG)
+  #define D_NAME(entp) (entp)->cFileName
+  #define D_TYPE(entp) ((entp)->dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY ? DT_DIR : DT_REG)
 
 #else
 
@@ -287,6 +287,10 @@ static void eio_destroy (eio_req *req);
 # include <sys/syscall.h>
 #endif
 
+#ifndef _WIN32
+# include <sys/uio.h>
+#endif
+
 #if HAVE_SENDFILE
 # if __linux
 #  include <sys/sendfile.h>
@@ -302,11 +306,26 @@ static void eio_destroy (eio_req *req);
 # endif
 #endif
 
-#if HAVE_RENAMEAT2
+#if HAVE_RENAMEAT2 || HAVE_FICLONE
 # include <sys/syscall.h>
 # include <linux/fs.h>
 #endif
 
+#if HAVE_OPENAT2
+# include <sys/syscall.h>
+# include <stdio.h> /* sprintf */
+# include <linux/openat2.h>
+#endif
+
+#if HAVE_INOTIFY
+# include <sys/inotify.h>
+#endif
+
+#if HAVE_STATX
+# include <sys/vfs.h>
+# include <sys/sysmacros.h> /* makedev */
+#endif
+
 #ifndef D_TYPE
 # define D_TYPE(de) 0
 #endif
@@ -349,17 +368,20 @@ static void eio_destroy (eio_req *req);
 
 #define EIO_PATH_MAX (PATH_MAX <= EIO_PATH_MIN ? EIO_PATH_MIN : PATH_MAX)
 
-/* buffer size for various temporary buffers */
-#define EIO_BUFSIZE 65536
+/* chunk size for emulated sendfile and readahead, using the per-worker buffer */
+#ifndef EIO_EMULATE_BUFSIZE
+# define EIO_EMULATE_BUFSIZE (256 * 1024)
+#endif
 
-#define dBUF					\
-  char *eio_buf = malloc (EIO_BUFSIZE);		\
-  errno = ENOMEM;				\
-  if (!eio_buf)					\
-    return -1
+/* buffer size for the read/write loop of eio_copyfile */
+#ifndef EIO_COPYFILE_BUFSIZE
+# define EIO_COPYFILE_BUFSIZE (1024 * 1024)
+#endif
 
-#define FUBd					\
-  free (eio_buf)
+/* buffer size for the getdents64-based directory reader, 0 disables it */
+#ifndef EIO_GETDENTS_BUFSIZE
+# define EIO_GETDENTS_BUFSIZE (1024 * 1024)
+#endif
 
 /*****************************************************************************/
 
@@ -388,6 +410,7 @@ struct eio_pwd
 #define ETP_PRI_MAX EIO_PRI_MAX
 
 #define ETP_TYPE_QUIT -1
+#define ETP_TYPE_HELPER -2
 #define ETP_TYPE_GROUP EIO_GROUP
 
 static void eio_nop_callback (void) { }
@@ -397,6 +420,10 @@ static void (*eio_done_poll_cb)(void) = eio_nop_callback;
 #define ETP_WANT_POLL(pool) eio_want_poll_cb ()
 #define ETP_DONE_POLL(pool) eio_done_poll_cb ()
 
+/* a pipe for splicing in emulated sendfile, created on demand, valid when pipe_w is non-zero */
+#define ETP_WORKER_COMMON int pipe_r, pipe_w;
+#define ETP_WORKER_FREE(wrk) if ((wrk)->pipe_w) { close ((wrk)->pipe_r); close ((wrk)->pipe_w); }
+
 struct etp_worker;
 #define ETP_REQ eio_req
 #define ETP_DESTROY(req) eio_destroy (req)
@@ -404,6 +431,11 @@ static int eio_finish (eio_req *req);
 #define ETP_FINISH(req)  eio_finish (req)
 static void eio_execute (struct etp_worker *self, eio_req *req);
 #define ETP_EXECUTE(wrk,req) eio_execute (wrk, req)
+struct etp_pool;
+static int eio_coalesce (struct etp_pool *pool, eio_req *req);
+#define ETP_COALESCE(pool,req) eio_coalesce (pool, req)
+static int eio_inline (eio_req *req);
+#define ETP_INLINE(pool,req) eio_inline (req)
 
 #include "etp.c"
 
@@ -450,6 +482,9 @@ eio_destroy (eio_req *req)
 {
   if ((req)->flags & EIO_FLAG_PTR1_FREE) free (req->ptr1);
   if ((req)->flags & EIO_FLAG_PTR2_FREE) free (req->ptr2);
+#if _POSIX_MAPPED_FILES
+  if ((req)->flags & EIO_FLAG_MUNMAP) munmap ((char *)req->ptr2 - req->int2, req->size + req->int2);
+#endif
 
   EIO_DESTROY (req);
 }
@@ -560,6 +595,24 @@ eio_set_max_parallel (unsigned int nthreads)
   etp_set_max_parallel (EIO_POOL, nthreads);
 }
 
+void ecb_cold
+eio_set_tmpbuf_timeout (unsigned int seconds)
+{
+  etp_set_tmpbuf_timeout (EIO_POOL, seconds);
+}
+
+void ecb_cold
+eio_set_max_tmpbuf (size_t bytes)
+{
+  etp_set_max_tmpbuf (EIO_POOL, bytes);
+}
+
+size_t
+eio_tmpbuf_stats (size_t *sizes, unsigned int n)
+{
+  return etp_tmpbuf_stats (EIO_POOL, sizes, n);
+}
+
 int eio_poll (void)
 {
   return etp_poll (EIO_POOL);
@@ -680,6 +733,70 @@ eio__fallocate (int fd, int mode, off_t offset, size_t len)
 #endif
 }
 
+#ifndef _WIN32
+/* vectored read or write, at the file offset when offset is negative */
+static eio_ssize_t
+eio__rwv (int writing, int fd, const struct iovec *iov, int iovcnt, off_t offset, int flags)
+{
+#if HAVE_PREADV2
+  /* the EIO_RWF_* flags match the kernel ones */
+  if (flags)
+    {
+      eio_ssize_t res = writing
+                        ? pwritev2 (fd, iov, iovcnt, offset < 0 ? -1 : offset, flags)
+                        : preadv2  (fd, iov, iovcnt, offset < 0 ? -1 : offset, flags);
+
+      /* kernels before 4.6 lack the syscall */
+      if (res >= 0 || errno != ENOSYS)
+        return res;
+    }
+#endif
+
+  /* the synchronous writes can be emulated, everything else is only a hint or not possible */
+  if (flags & ~(EIO_RWF_HIPRI | EIO_RWF_DSYNC | EIO_RWF_SYNC) || (!writing && flags & (EIO_RWF_DSYNC | EIO_RWF_SYNC)))
+    return EIO_ERRNO (EOPNOTSUPP, -1);
+
+  {
+    eio_ssize_t res;
+
+    if (offset < 0)
+      res = writing ? writev (fd, iov, iovcnt) : readv (fd, iov, iovcnt);
+    else
+      {
+#if HAVE_PREADV
+        res = writing ? pwritev (fd, iov, iovcnt, offset) : preadv (fd, iov, iovcnt, offset);
+#else
+        int i;
+
+        /* stop at the first short transfer, like the real thing */
+        for (res = i = 0; i < iovcnt; ++i)
+          {
+            eio_ssize_t cnt = writing
+                              ? pwrite (fd, iov [i].iov_base, iov [i].iov_len, offset + res)
+                              : pread  (fd, iov [i].iov_base, iov [i].iov_len, offset + res);
+
+            if (cnt < 0)
+              {
+                if (!res) res = -1;
+                break;
+              }
+
+            res += cnt;
+
+            if (cnt < iov [i].iov_len)
+              break;
+          }
+#endif
+      }
+
+    if (res >= 0 && flags & EIO_RWF_SYNC   && fsync     (fd)) return -1;
+    if (res >= 0 && flags & EIO_RWF_DSYNC  && fdatasync (fd)) return -1;
+
+    return res;
+  }
+}
+#endif
+
 #if !HAVE_READAHEAD
 # undef readahead
 # define readahead(fd,offset,count) eio__readahead (fd, offset, count, self)
@@ -688,19 +805,20 @@ static eio_ssize_t
 eio__readahead (int fd, off_t offset, size_t count, etp_worker *self)
 {
   size_t todo = count;
-  dBUF;
+  char *buf = etp_tmpbuf_get (&self->tmpbuf, EIO_EMULATE_BUFSIZE);
+
+  if (!buf)
+    return EIO_ERRNO (ENOMEM, -1);
 
   while (todo > 0)
     {
-      size_t len = todo < EIO_BUFSIZE ? todo : EIO_BUFSIZE;
+      size_t len = todo < EIO_EMULATE_BUFSIZE ? todo : EIO_EMULATE_BUFSIZE;
 
-      pread (fd, eio_buf, len, offset);
+      pread (fd, buf, len, offset);
       offset += len;
       todo   -= len;
     }
 
-  FUBd;
-
   /* linux's readahead basically only fails for EBADF or EINVAL (not mmappable) */
   /* but not for e.g. EIO or eof, so we also never fail */
   return 0;
@@ -708,9 +826,126 @@ eio__readahead (int fd, off_t offset, size_t count, etp_worker *self)
 
 #endif
 
-/* sendfile always needs emulation */
+static int
+eio__fadvise (int fd, off_t offset, size_t len, int advice, etp_worker *self)
+{
+#if HAVE_POSIX_FADVISE
+  static const int advices [] = {
+    POSIX_FADV_NORMAL, POSIX_FADV_RANDOM, POSIX_FADV_SEQUENTIAL,
+    POSIX_FADV_WILLNEED, POSIX_FADV_DONTNEED, POSIX_FADV_NOREUSE
+  };
+  int res;
+
+  if ((unsigned int)advice >= sizeof (advices) / sizeof (advices [0]))
+    return EIO_ERRNO (EINVAL, -1);
+
+  /* posix_fadvise returns the error instead of setting errno */
+  res = posix_fadvise (fd, offset, len, advices [advice]);
+
+  return res ? EIO_ERRNO (res, -1) : 0;
+#else
+  if ((unsigned int)advice > EIO_FADV_NOREUSE)
+    return EIO_ERRNO (EINVAL, -1);
+
+  /* all advice is optional, except that we can emulate willneed */
+  if (advice == EIO_FADV_WILLNEED)
+    return readahead (fd, offset, len);
+
+  return 0;
+#endif
+}
+
+#if HAVE_SPLICE
+/* splice from a file to a pipe, or through the per-worker pipe to a socket */
+/* fails with EINVAL if neither is possible, before writing anything */
+static eio_ssize_t
+eio__splicefile (int ofd, int ifd, off_t offset, size_t count, etp_worker *self)
+{
+  EIO_STRUCT_STAT buf;
+  eio_ssize_t res = 0;
+
+  if (fstat (ofd, &buf))
+    return -1;
+
+  if (S_ISFIFO (buf.st_mode))
+    while (count)
+      {
+        loff_t soffset = offset;
+        eio_ssize_t cnt = splice (ifd, &soffset, ofd, 0, count, SPLICE_F_MOVE);
+
+        if (cnt <= 0)
+          {
+            if (cnt && !res) res = -1;
+            break;
+          }
+
+        offset += cnt;
+        res    += cnt;
+        count  -= cnt;
+      }
+  else if (S_ISSOCK (buf.st_mode) && self)
+    {
+      if (!self->pipe_w)
+        {
+          int fds [2];
+
+          if (pipe (fds))
+            return -1;
+
+          fcntl (fds [0], F_SETFD, FD_CLOEXEC);
+          fcntl (fds [1], F_SETFD, FD_CLOEXEC);
+
+          self->pipe_r = fds [0];
+          self->pipe_w = fds [1];
+        }
+
+      while (count)
+        {
+          loff_t soffset = offset;
+          eio_ssize_t cnt = splice (ifd, &soffset, self->pipe_w, 0,
+                                    count < EIO_EMULATE_BUFSIZE ? count : EIO_EMULATE_BUFSIZE,
+                                    SPLICE_F_MOVE | SPLICE_F_MORE);
+
+          if (cnt <= 0)
+            {
+              if (cnt && !res) res = -1;
+              break;
+            }
+
+          offset += cnt;
+          count  -= cnt;
+
+          while (cnt)
+            {
+              eio_ssize_t wr = splice (self->pipe_r, 0, ofd, 0, cnt, SPLICE_F_MOVE | (count ? SPLICE_F_MORE : 0));
+
+              if (wr <= 0)
+                {
+                  int errorno = errno;
+
+                  /* whatever is left in the pipe is lost, so start over with a new pipe next time */
+                  close (self->pipe_r);
+                  close (self->pipe_w);
+                  self->pipe_w = 0;
+
+                  return res ? res : EIO_ERRNO (wr ? errorno : EPIPE, -1);
+                }
+
+              res += wr;
+              cnt -= wr;
+            }
+        }
+    }
+  else
+    return EIO_ERRNO (EINVAL, -1);
+
+  return res;
+}
+#endif
+
+/* sendfile always needs emulation, self is 0 for synchronous calls */
 static eio_ssize_t
-eio__sendfile (int ofd, int ifd, off_t offset, size_t count)
+eio__sendfile (int ofd, int ifd, off_t offset, size_t count, etp_worker *self)
 {
   eio_ssize_t written = 0;
   eio_ssize_t res;
@@ -827,7 +1062,20 @@ eio__sendfile (int ofd, int ifd, off_t offset, size_t count)
       )
     {
       /* emulate sendfile. this is a major pain in the ass */
-      dBUF;
+      struct etp_tmpbuf tmpbuf = { 0 };
+      char *buf;
+
+#if HAVE_SPLICE
+      res = eio__splicefile (ofd, ifd, offset, count, self);
+
+      if (res >= 0 || (errno != EINVAL && errno != ENOSYS))
+        return res;
+#endif
+
+      buf = etp_tmpbuf_get (self ? &self->tmpbuf : &tmpbuf, EIO_EMULATE_BUFSIZE);
+
+      if (!buf)
+        return EIO_ERRNO (ENOMEM, -1);
 
       res = 0;
 
@@ -835,7 +1083,7 @@ eio__sendfile (int ofd, int ifd, off_t offset, size_t count)
         {
           eio_ssize_t cnt;
           
-          cnt = pread (ifd, eio_buf, count > EIO_BUFSIZE ? EIO_BUFSIZE : count, offset);
+          cnt = pread (ifd, buf, count > EIO_EMULATE_BUFSIZE ? EIO_EMULATE_BUFSIZE : count, offset);
 
           if (cnt <= 0)
             {
@@ -843,7 +1091,7 @@ eio__sendfile (int ofd, int ifd, off_t offset, size_t count)
               break;
             }
 
-          cnt = write (ofd, eio_buf, cnt);
+          cnt = write (ofd, buf, cnt);
 
           if (cnt <= 0)
             {
@@ -856,12 +1104,206 @@ eio__sendfile (int ofd, int ifd, off_t offset, size_t count)
           count  -= cnt;
         }
 
-      FUBd;
+      free (tmpbuf.ptr);
     }
 
   return res;
 }
 
+/* the ways eio__copyrange can copy data, in order of preference */
+enum
+{
+  EIO_COPY_RANGE, /* copy_file_range */
+  EIO_COPY_SEND,  /* sendfile, writing at the file offset */
+  EIO_COPY_RW     /* pread/pwrite */
+};
+
+/* copy len bytes at offset from ifd to the same offset in ofd, returns the number of bytes */
+/* copied, which is only less than len at eof. *method is advanced when a method is unsupported */
+static off_t
+eio__copyrange (int ofd, int ifd, off_t offset, off_t len, int *method, etp_worker *self)
+{
+  off_t copied = 0;
+
+  while (copied < len)
+    {
+      /* stay below the 2gb limit of many kernels */
+      size_t count = len - copied > 0x40000000 ? 0x40000000 : len - copied;
+      eio_ssize_t res;
+
+      switch (*method)
+        {
+          case EIO_COPY_RANGE:
+#if HAVE_COPY_FILE_RANGE
+            {
+              off_t ioffset = offset, ooffset = offset;
+
+              res = copy_file_range (ifd, &ioffset, ofd, &ooffset, count, 0);
+            }
+
+            /* older kernels only support copies within one filesystem, or between regular files */
+            if (res < 0 && (errno == ENOSYS || errno == EXDEV || errno == EINVAL
+#ifdef EOPNOTSUPP
+                            || errno == EOPNOTSUPP
+#endif
+               ))
+              {
+                *method = EIO_COPY_SEND;
+                continue;
+              }
+
+            break;
+#endif
+
+          case EIO_COPY_SEND:
+#if HAVE_SENDFILE && __linux
+            if (lseek (ofd, offset, SEEK_SET) < 0)
+              return -1;
+
+            {
+              off_t ioffset = offset;
+
+              res = sendfile (ofd, ifd, &ioffset, count);
+            }
+
+            if (res < 0 && (errno == ENOSYS || errno == EINVAL))
+              {
+                *method = EIO_COPY_RW;
+                continue;
+              }
+
+            break;
+#endif
+
+          default:
+            {
+              char *buf = etp_tmpbuf_get (&self->tmpbuf, EIO_COPYFILE_BUFSIZE);
+              eio_ssize_t wr;
+
+              if (!buf)
+                return EIO_ERRNO (ENOMEM, -1);
+
+              res = pread (ifd, buf, count < EIO_COPYFILE_BUFSIZE ? count : EIO_COPYFILE_BUFSIZE, offset);
+
+              for (wr = 0; wr < res; )
+                {
+                  eio_ssize_t cnt = pwrite (ofd, buf + wr, res - wr, offset + wr);
+
+                  if (cnt < 0)
+                    return -1;
+
+                  wr += cnt;
+                }
+            }
+
+            break;
+        }
+
+      if (res < 0)
+        {
+          if (errno == EINTR)
+            continue;
+
+          return -1;
+        }
+
+      if (!res)
+        break;
+
+      offset += res;
+      copied += res;
+    }
+
+  return copied;
+}
+
+/* copy the whole contents of ifd to ofd, keeping holes */
+static eio_ssize_t
+eio__copyfile (int ofd, int ifd, int flags, etp_worker *self)
+{
+  EIO_STRUCT_STAT buf;
+  off_t size, pos, data, hole, saved;
+  int method = EIO_COPY_RANGE;
+
+  if (fstat (ifd, &buf))
+    return -1;
+
+  if (!S_ISREG (buf.st_mode))
+    return EIO_ERRNO (EINVAL, -1);
+
+  size = buf.st_size;
+
+  /* the clone would otherwise leave any longer tail of ofd in place */
+  if (ftruncate (ofd, 0))
+    return -1;
+
+#if HAVE_FICLONE
+  /* share all extents, on filesystems that support it, this is instant */
+  if (!(flags & EIO_COPYFILE_NOREFLINK) && !ioctl (ofd, FICLONE, ifd))
+    return size;
+#endif
+
+  /* start from an empty, but correctly sized, file, so holes stay holes */
+  if (ftruncate (ofd, size))
+    return -1;
+
+  /* SEEK_DATA/SEEK_HOLE move the file offset, which we must not change */
+  saved = lseek (ifd, 0, SEEK_CUR);
+
+  for (pos = 0; pos < size; pos = hole)
+    {
+      off_t copied;
+
+#if defined SEEK_DATA && defined SEEK_HOLE
+      data = lseek (ifd, pos, SEEK_DATA);
+
+      if (data < 0)
+        {
+          if (errno == ENXIO)
+            break; /* only a hole left */
+
+          /* not supported, treat everything as data */
+          data = pos;
+          hole = size;
+        }
+      else if (data >= size)
+        break;
+      else
+        {
+          hole = lseek (ifd, data, SEEK_HOLE);
+
+          if (hole < 0 || hole > size)
+            hole = size;
+        }
+#else
+      data = pos;
+      hole = size;
+#endif
+
+      copied = eio__copyrange (ofd, ifd, data, hole - data, &method, self);
+
+      if (copied < 0)
+        {
+          int errorno = errno;
+          lseek (ifd, saved, SEEK_SET);
+          return EIO_ERRNO (errorno, -1);
+        }
+
+      /* the file shrank while we copied it */
+      if (copied < hole - data)
+        {
+          size = data + copied;
+          if (ftruncate (ofd, size))
+            break;
+        }
+    }
+
+  if (saved >= 0)
+    lseek (ifd, saved, SEEK_SET);
+
+  return size;
+}
+
 #ifdef PAGESIZE
 # define eio_pagesize() PAGESIZE
 #else
@@ -987,897 +1429,4858 @@ eio__mtouch (eio_req *req)
   return 0;
 }
 
-/*****************************************************************************/
-/* requests implemented outside eio_execute, because they are so large */
+#define EIO_MINCORE_WINDOW (64 * 1024 * 1024) /* file range mapped at a time */
 
-static void
-eio__lseek (eio_req *req)
+/* stores a bitmap of the pages of the file range that are in the page cache */
+/* in ptr2, or only counts them, returns the number of cached pages */
+static eio_ssize_t
+eio__mincore (etp_worker *self, eio_req *req)
 {
-  /* this usually gets optimised away completely, or your compiler sucks, */
-  /* or the whence constants really are not 0, 1, 2 */
-  int whence = req->int2 == EIO_SEEK_SET ? SEEK_SET
-             : req->int2 == EIO_SEEK_CUR ? SEEK_CUR
-             : req->int2 == EIO_SEEK_END ? SEEK_END
-             : req->int2;
+#if _POSIX_MAPPED_FILES && HAVE_MINCORE
+  intptr_t page = eio_pagesize ();
+  EIO_STRUCT_STAT st;
+  unsigned char *vec, *map = 0;
+  eio_ssize_t cached = 0;
+  off_t pos, end;
+
+  if (fstat (req->int1, &st))
+    return -1;
 
-  req->offs   = lseek (req->int1, req->offs, whence);
-  req->result = req->offs == (off_t)-1 ? -1 : 0;
-}
+  if (!S_ISREG (st.st_mode) || req->offs < 0)
+    return EIO_ERRNO (EINVAL, -1);
 
-/* result will always end up in tmpbuf, there is always space for adding a 0-byte */
-static int
-eio__realpath (struct etp_tmpbuf *tmpbuf, eio_wd wd, const char *path)
-{
-  char *res;
-  const char *rel = path;
-  char *tmp1, *tmp2;
-#if SYMLOOP_MAX > 32
-  int symlinks = SYMLOOP_MAX;
-#else
-  int symlinks = 32;
-#endif
+  /* round the range out to full pages */
+  if (req->size)
+    req->size += req->offs & (page - 1);
 
-  errno = EINVAL;
-  if (!rel)
-    return -1;
+  req->offs &= ~(off_t)(page - 1);
+
+  end = req->size && req->offs + (off_t)req->size < st.st_size ? req->offs + (off_t)req->size : st.st_size;
+
+  if (end < req->offs)
+    end = req->offs;
+
+  req->size = end - req->offs;
+
+#if HAVE_SYS_SYSCALL_H && defined __NR_cachestat
+  /* linux 6.5+ counts without mapping anything */
+  if (req->int2 & EIO_MINCORE_COUNT && req->size)
+    {
+      struct { unsigned long long off, len; } range;
+      struct { unsigned long long nr_cache, nr_dirty, nr_writeback, nr_evicted, nr_recently_evicted; } cs;
+
+      range.off = req->offs;
+      range.len = req->size;
+
+      if (!syscall (__NR_cachestat, req->int1, &range, &cs, 0))
+        return cs.nr_cache;
+    }
+#endif
+
+  if (!(req->int2 & EIO_MINCORE_COUNT))
+    {
+      X_LOCK (EIO_POOL->wrklock);
+      req->flags |= EIO_FLAG_PTR2_FREE;
+      X_UNLOCK (EIO_POOL->wrklock);
+
+      /* one bit per page, at least one octet */
+      req->ptr2 = map = (unsigned char *)calloc ((req->size / page + 8) / 8, 1);
+
+      if (!map)
+        return EIO_ERRNO (ENOMEM, -1);
+    }
+
+  vec = (unsigned char *)etp_tmpbuf_get (&self->tmpbuf, EIO_MINCORE_WINDOW / page);
+
+  if (!vec)
+    return EIO_ERRNO (ENOMEM, -1);
+
+  for (pos = req->offs; pos < end; pos += EIO_MINCORE_WINDOW)
+    {
+      size_t len = end - pos < EIO_MINCORE_WINDOW ? end - pos : EIO_MINCORE_WINDOW;
+      size_t i, n = (len + page - 1) / page, base = (pos - req->offs) / page;
+      void *addr;
+      int res;
+
+      if (EIO_CANCELLED (req))
+        return EIO_ERRNO (ECANCELED, -1);
+
+      addr = mmap (0, len, PROT_READ, MAP_SHARED, req->int1, pos);
+
+      if (addr == MAP_FAILED)
+        return -1;
+
+      res = mincore (addr, len, (void *)vec);
+      munmap (addr, len);
+
+      if (res)
+        return -1;
+
+      for (i = 0; i < n; ++i)
+        if (vec [i] & 1)
+          {
+            ++cached;
+
+            if (map)
+              map [(base + i) >> 3] |= 1 << ((base + i) & 7);
+          }
+    }
+
+  return cached;
+#else
+  return EIO_ENOSYS ();
+#endif
+}
+
+double
+eio_mincore_percent (const eio_req *req)
+{
+  size_t pages = (req->size + eio_pagesize () - 1) / eio_pagesize ();
+
+  return req->result > 0 && pages ? req->result * 100. / pages : 0.;
+}
+
+/*****************************************************************************/
+/* cache of the symlink lookups eio__realpath does for every path component */
+
+struct eio_pathent
+{
+  struct eio_pathent *hnext;       /* hash chain */
+  struct eio_pathent *prev, *next; /* lru list, most recently used first */
+  unsigned int hash;
+  unsigned int gen;                /* eio_pathcache_gen when the lookup was started */
+  eio_tstamp expires;              /* 0 if only a new generation expires the entry */
+  int linklen;                     /* length of the symlink target, -1 if the path is no symlink */
+  char path [1];                   /* actually, the path, a 0-byte and the symlink target */
+};
+
+static xmutex_t eio_pathcache_lock = X_MUTEX_INIT;
+static unsigned int eio_pathcache_max; /* maximum number of entries, 0 if disabled */
+static unsigned int eio_pathcache_count;
+static unsigned int eio_pathcache_gen; /* incremented whenever paths might have changed */
+static eio_tstamp eio_pathcache_ttl;
+static struct eio_pathent **eio_pathcache_hash;
+static unsigned int eio_pathcache_mask; /* number of hash buckets - 1 */
+static struct eio_pathent *eio_pathcache_first, *eio_pathcache_last; /* lru list */
+
+static eio_tstamp
+eio__now (void)
+{
+  struct timeval tv;
+
+  gettimeofday (&tv, 0);
+
+  return tv.tv_sec + tv.tv_usec * 1e-6;
+}
+
+/* fnv-1a */
+static unsigned int
+eio__strhash (unsigned int hash, const char *str)
+{
+  hash ^= 2166136261U;
+
+  while (*str)
+    hash = (hash ^ (unsigned char)*str++) * 16777619U;
+
+  return hash;
+}
+
+static void
+eio__pathcache_unlink (struct eio_pathent *e)
+{
+  struct eio_pathent **p;
+
+  for (p = eio_pathcache_hash + (e->hash & eio_pathcache_mask); *p != e; p = &(*p)->hnext)
+    ;
+
+  *p = e->hnext;
+
+  if (e->prev) e->prev->next = e->next; else eio_pathcache_first = e->next;
+  if (e->next) e->next->prev = e->prev; else eio_pathcache_last  = e->prev;
+
+  --eio_pathcache_count;
+  free (e);
+}
+
+void ecb_cold
+eio_set_path_cache (unsigned int entries, eio_tstamp ttl)
+{
+  X_LOCK (eio_pathcache_lock);
+
+  while (eio_pathcache_first)
+    eio__pathcache_unlink (eio_pathcache_first);
+
+  free (eio_pathcache_hash);
+  eio_pathcache_hash = 0;
+  eio_pathcache_max  = 0;
+
+  if (entries)
+    {
+      unsigned int size = 16;
+
+      while (size < entries && size < 0x40000000U)
+        size <<= 1;
+
+      eio_pathcache_hash = (struct eio_pathent **)calloc (size, sizeof (struct eio_pathent *));
+
+      if (eio_pathcache_hash)
+        {
+          eio_pathcache_mask = size - 1;
+          eio_pathcache_max  = entries;
+          eio_pathcache_ttl  = ttl;
+        }
+    }
+
+  X_UNLOCK (eio_pathcache_lock);
+}
+
+/* readlink with an EIO_PATH_MAX buffer, fails with EINVAL for anything but symlinks */
+static eio_ssize_t
+eio__readlink_cached (const char *path, char *buf)
+{
+  struct eio_pathent *e;
+  unsigned int hash, gen;
+  eio_ssize_t linklen;
+  int len;
+
+  if (!eio_pathcache_max)
+    return readlink (path, buf, EIO_PATH_MAX);
+
+  hash = eio__strhash (0, path);
+
+  X_LOCK (eio_pathcache_lock);
+
+  for (e = eio_pathcache_hash ? eio_pathcache_hash [hash & eio_pathcache_mask] : 0; e; e = e->hnext)
+    if (e->hash == hash && !strcmp (e->path, path))
+      break;
+
+  if (e && (e->gen != eio_pathcache_gen || (e->expires && e->expires <= eio__now ())))
+    {
+      eio__pathcache_unlink (e);
+      e = 0;
+    }
+
+  if (e)
+    {
+      if (e->prev)
+        {
+          e->prev->next = e->next;
+          if (e->next) e->next->prev = e->prev; else eio_pathcache_last = e->prev;
+
+          e->prev = 0;
+          e->next = eio_pathcache_first;
+          eio_pathcache_first->prev = e;
+          eio_pathcache_first = e;
+        }
+
+      linklen = e->linklen;
+
+      if (linklen >= 0)
+        memcpy (buf, e->path + strlen (e->path) + 1, linklen);
+
+      X_UNLOCK (eio_pathcache_lock);
+
+      if (linklen < 0)
+        errno = EINVAL;
+
+      return linklen;
+    }
+
+  gen = eio_pathcache_gen;
+
+  X_UNLOCK (eio_pathcache_lock);
+
+  linklen = readlink (path, buf, EIO_PATH_MAX);
+
+  /* errors like ENOENT would not stay valid long enough to be worth caching */
+  if (linklen < 0 && errno != EINVAL)
+    return linklen;
+
+  len = strlen (path);
+  e = (struct eio_pathent *)malloc (sizeof *e + len + 1 + (linklen > 0 ? linklen : 0));
+
+  if (!e)
+    {
+      errno = EINVAL;
+      return linklen;
+    }
+
+  e->hash    = hash;
+  e->gen     = gen;
+  e->linklen = linklen;
+  memcpy (e->path, path, len + 1);
+
+  if (linklen > 0)
+    memcpy (e->path + len + 1, buf, linklen);
+
+  X_LOCK (eio_pathcache_lock);
+
+  e->expires = eio_pathcache_ttl ? eio__now () + eio_pathcache_ttl : 0.;
+
+  /* the cache might have been disabled in the meantime */
+  if (eio_pathcache_max)
+    {
+      struct eio_pathent *old;
+
+      for (old = eio_pathcache_hash [hash & eio_pathcache_mask]; old; old = old->hnext)
+        if (old->hash == hash && !strcmp (old->path, path))
+          {
+            eio__pathcache_unlink (old);
+            break;
+          }
+
+      e->hnext = eio_pathcache_hash [hash & eio_pathcache_mask];
+      eio_pathcache_hash [hash & eio_pathcache_mask] = e;
+
+      e->prev = 0;
+      e->next = eio_pathcache_first;
+      if (e->next) e->next->prev = e; else eio_pathcache_last = e;
+      eio_pathcache_first = e;
+
+      if (++eio_pathcache_count > eio_pathcache_max)
+        eio__pathcache_unlink (eio_pathcache_last);
+    }
+  else
+    free (e);
+
+  X_UNLOCK (eio_pathcache_lock);
+
+  if (linklen < 0)
+    errno = EINVAL;
+
+  return linklen;
+}
+
+/*****************************************************************************/
+/* cache of directory fds, so requests on absolute paths only resolve their last component */
+
+#ifdef O_PATH
+  #define EIO_DIRCACHE_OFLAGS (O_PATH | O_DIRECTORY | O_CLOEXEC)
+#else
+  #define EIO_DIRCACHE_OFLAGS (O_SEARCH | O_DIRECTORY | O_CLOEXEC | O_NONBLOCK)
+#endif
+
+struct eio_dirfd
+{
+  struct eio_dirfd *hnext;       /* hash chain */
+  struct eio_dirfd *prev, *next; /* lru list, most recently used first */
+  unsigned int hash;
+  unsigned int refcnt;           /* requests using fd right now */
+  unsigned char detached;        /* no longer cached, fd is closed by the last user */
+  int fd;
+  eio_tstamp expires;            /* 0 if the entry only expires when evicted or flushed */
+  char path [1];                 /* actually, longer */
+};
+
+static xmutex_t eio_dircache_lock = X_MUTEX_INIT;
+static unsigned int eio_dircache_max; /* maximum number of fds, 0 if disabled */
+static unsigned int eio_dircache_count;
+static unsigned int eio_dircache_gen; /* incremented by every flush */
+static eio_tstamp eio_dircache_ttl;
+static struct eio_dirfd **eio_dircache_hash;
+static unsigned int eio_dircache_mask; /* number of hash buckets - 1 */
+static struct eio_dirfd *eio_dircache_first, *eio_dircache_last; /* lru list */
+
+/* removes d from the cache, closing its fd unless it is in use */
+static void
+eio__dircache_detach (struct eio_dirfd *d)
+{
+  struct eio_dirfd **p;
+
+  for (p = eio_dircache_hash + (d->hash & eio_dircache_mask); *p != d; p = &(*p)->hnext)
+    ;
+
+  *p = d->hnext;
+
+  if (d->prev) d->prev->next = d->next; else eio_dircache_first = d->next;
+  if (d->next) d->next->prev = d->prev; else eio_dircache_last  = d->prev;
+
+  --eio_dircache_count;
+
+  if (d->refcnt)
+    d->detached = 1;
+  else
+    {
+      silent_close (d->fd);
+      free (d);
+    }
+}
+
+/* evicts unused entries, least recently used first, until the fd budget is met */
+static void
+eio__dircache_trim (void)
+{
+  struct eio_dirfd *d, *prev;
+
+  for (d = eio_dircache_last; d && eio_dircache_count > eio_dircache_max; d = prev)
+    {
+      prev = d->prev;
+
+      if (!d->refcnt)
+        eio__dircache_detach (d);
+    }
+}
+
+static void
+eio__dircache_flush (void)
+{
+  X_LOCK (eio_dircache_lock);
+
+  ++eio_dircache_gen;
+
+  while (eio_dircache_first)
+    eio__dircache_detach (eio_dircache_first);
+
+  X_UNLOCK (eio_dircache_lock);
+}
+
+void ecb_cold
+eio_set_dir_cache (unsigned int nfds, eio_tstamp ttl)
+{
+  eio__dircache_flush ();
+
+  X_LOCK (eio_dircache_lock);
+
+  free (eio_dircache_hash);
+  eio_dircache_hash = 0;
+  eio_dircache_max  = 0;
+
+#if HAVE_AT
+  if (nfds)
+    {
+      unsigned int size = 16;
+
+      while (size < nfds && size < 0x40000000U)
+        size <<= 1;
+
+      eio_dircache_hash = (struct eio_dirfd **)calloc (size, sizeof (struct eio_dirfd *));
+
+      if (eio_dircache_hash)
+        {
+          eio_dircache_mask = size - 1;
+          eio_dircache_max  = nfds;
+          eio_dircache_ttl  = ttl;
+        }
+    }
+#endif
+
+  X_UNLOCK (eio_dircache_lock);
+}
+
+/* returns the entry for the directory containing the absolute path req->ptr1, */
+/* opening it if needed, or 0 if the path cannot be split or the directory not opened */
+static struct eio_dirfd *
+eio__dircache_get (struct etp_tmpbuf *tmpbuf, eio_req *req)
+{
+  const char *path = req->ptr1;
+  const char *base = strrchr (path, '/') + 1;
+  int len = base - path > 1 ? base - path - 1 : 1; /* keep the / of the root directory */
+  struct eio_dirfd *d;
+  unsigned int hash, gen;
+  char *dir;
+  int fd;
+
+  if (!*base || (base [0] == '.' && (!base [1] || (base [1] == '.' && !base [2]))))
+    return 0;
+
+  dir = etp_tmpbuf_get (tmpbuf, len + 1);
+
+  if (!dir)
+    return 0;
+
+  memcpy (dir, path, len);
+  dir [len] = 0;
+
+  hash = eio__strhash (0, dir);
+
+  X_LOCK (eio_dircache_lock);
+
+  for (d = eio_dircache_hash ? eio_dircache_hash [hash & eio_dircache_mask] : 0; d; d = d->hnext)
+    if (d->hash == hash && !strcmp (d->path, dir))
+      break;
+
+  if (d && d->expires && d->expires <= eio__now ())
+    {
+      eio__dircache_detach (d);
+      d = 0;
+    }
+
+  if (d)
+    {
+      if (d->prev)
+        {
+          d->prev->next = d->next;
+          if (d->next) d->next->prev = d->prev; else eio_dircache_last = d->prev;
+
+          d->prev = 0;
+          d->next = eio_dircache_first;
+          eio_dircache_first->prev = d;
+          eio_dircache_first = d;
+        }
+
+      ++d->refcnt;
+
+      X_UNLOCK (eio_dircache_lock);
+
+      return d;
+    }
+
+  gen = eio_dircache_gen;
+
+  X_UNLOCK (eio_dircache_lock);
+
+  fd = open (dir, EIO_DIRCACHE_OFLAGS);
+
+  if (fd < 0)
+    return 0;
+
+  d = (struct eio_dirfd *)malloc (sizeof *d + len);
+
+  if (!d)
+    {
+      silent_close (fd);
+      return 0;
+    }
+
+  d->hash     = hash;
+  d->refcnt   = 1;
+  d->detached = 0;
+  d->fd       = fd;
+  memcpy (d->path, dir, len + 1);
+
+  X_LOCK (eio_dircache_lock);
+
+  /* a flush in the meantime might have been about this directory, */
+  /* so only this request uses the fd then */
+  if (gen == eio_dircache_gen && eio_dircache_max)
+    {
+      struct eio_dirfd *old;
+
+      for (old = eio_dircache_hash [hash & eio_dircache_mask]; old; old = old->hnext)
+        if (old->hash == hash && !strcmp (old->path, d->path))
+          {
+            eio__dircache_detach (old);
+            break;
+          }
+
+      d->expires = eio_dircache_ttl ? eio__now () + eio_dircache_ttl : 0.;
+
+      d->hnext = eio_dircache_hash [hash & eio_dircache_mask];
+      eio_dircache_hash [hash & eio_dircache_mask] = d;
+
+      d->prev = 0;
+      d->next = eio_dircache_first;
+      if (d->next) d->next->prev = d; else eio_dircache_last = d;
+      eio_dircache_first = d;
+
+      ++eio_dircache_count;
+      eio__dircache_trim ();
+    }
+  else
+    d->detached = 1;
+
+  X_UNLOCK (eio_dircache_lock);
+
+  return d;
+}
+
+static void
+eio__dircache_put (struct eio_dirfd *d)
+{
+  X_LOCK (eio_dircache_lock);
+
+  if (!--d->refcnt)
+    {
+      if (d->detached)
+        {
+          silent_close (d->fd);
+          free (d);
+        }
+      else if (eio_dircache_count > eio_dircache_max)
+        eio__dircache_trim ();
+    }
+
+  X_UNLOCK (eio_dircache_lock);
+}
+
+static void
+eio__pathcache_expire (void)
+{
+  /* entries of older generations are dropped when they are found */
+  X_LOCK (eio_pathcache_lock);
+  ++eio_pathcache_gen;
+  X_UNLOCK (eio_pathcache_lock);
+}
+
+void
+eio_invalidate_path_cache (void)
+{
+  eio__pathcache_expire ();
+  eio__dircache_flush ();
+}
+
+/*****************************************************************************/
+/* requests implemented outside eio_execute, because they are so large */
+
+static void
+eio__lseek (eio_req *req)
+{
+  /* this usually gets optimised away completely, or your compiler sucks, */
+  /* or the whence constants really are not 0, 1, 2 */
+  int whence = req->int2 == EIO_SEEK_SET ? SEEK_SET
+             : req->int2 == EIO_SEEK_CUR ? SEEK_CUR
+             : req->int2 == EIO_SEEK_END ? SEEK_END
+             : req->int2;
+
+  req->offs   = lseek (req->int1, req->offs, whence);
+  req->result = req->offs == (off_t)-1 ? -1 : 0;
+}
+
+/* result will always end up in tmpbuf, there is always space for adding a 0-byte */
+static int
+eio__realpath (struct etp_tmpbuf *tmpbuf, eio_wd wd, const char *path)
+{
+  char *res;
+  const char *rel = path;
+  char *tmp1, *tmp2;
+#if SYMLOOP_MAX > 32
+  int symlinks = SYMLOOP_MAX;
+#else
+  int symlinks = 32;
+#endif
+
+  errno = EINVAL;
+  if (!rel)
+    return -1;
 
   errno = ENOENT;
   if (!*rel)
     return -1;
 
-  res = etp_tmpbuf_get (tmpbuf, EIO_PATH_MAX * 3);
-#ifdef _WIN32
-  if (_access (rel, 4) != 0)
-    return -1;
+  res = etp_tmpbuf_get (tmpbuf, EIO_PATH_MAX * 3);
+#ifdef _WIN32
+  if (_access (rel, 4) != 0)
+    return -1;
+
+  symlinks = GetFullPathName (rel, EIO_PATH_MAX * 3, res, 0);
+
+  errno = ENAMETOOLONG;
+  if (symlinks >= EIO_PATH_MAX * 3)
+    return -1;
+
+  errno = EIO;
+  if (symlinks <= 0)
+    return -1;
+
+  return symlinks;
+
+#else
+  tmp1 = res  + EIO_PATH_MAX;
+  tmp2 = tmp1 + EIO_PATH_MAX;
+
+#if HAVE_AT && HAVE_OPENAT2
+  /* on linux, ask the kernel, which is only safe if the path it reports */
+  /* still refers to what was opened, otherwise fall back to walking the path */
+  if (!eio_pathcache_max && wd != EIO_INVALID_WD)
+    {
+      struct open_how how;
+      int fd;
+
+      memset (&how, 0, sizeof how);
+      how.flags   = O_PATH | O_CLOEXEC;
+      how.resolve = RESOLVE_NO_MAGICLINKS;
+
+      fd = syscall (SYS_openat2, WD2FD (wd), rel, &how, sizeof how);
+
+      if (fd >= 0)
+        {
+          EIO_STRUCT_STAT st1, st2;
+          eio_ssize_t len;
+
+          sprintf (tmp1, "/proc/self/fd/%d", fd);
+          len = readlink (tmp1, res, EIO_PATH_MAX);
+
+          /* unreachable or deleted files have no usable path */
+          if (len > 0 && len < EIO_PATH_MAX && *res == '/')
+            {
+              res [len] = 0;
+
+              if (!fstat (fd, &st1) && !stat (res, &st2)
+                  && st1.st_dev == st2.st_dev && st1.st_ino == st2.st_ino)
+                {
+                  eio__close (fd);
+                  return len;
+                }
+            }
+
+          eio__close (fd);
+        }
+      else if (errno == ENOENT || errno == ENOTDIR || errno == ENAMETOOLONG || errno == EACCES)
+        return -1;
+    }
+#endif
+
+  if (*rel != '/')
+    {
+      int len;
+
+      errno = ENOENT;
+      if (wd == EIO_INVALID_WD)
+        return -1;
+      
+      if (wd == EIO_CWD)
+        {
+          if (!getcwd (res, EIO_PATH_MAX))
+            return -1;
+
+          len = strlen (res);
+        }
+      else
+        memcpy (res, wd->str, len = wd->len);
+
+      if (res [1]) /* only use if not / */
+        res += len;
+    }
+
+  while (*rel)
+    {
+      eio_ssize_t len, linklen;
+      const char *beg = rel;
+
+      while (*rel && *rel != '/')
+        ++rel;
+
+      len = rel - beg;
+
+      if (!len) /* skip slashes */
+        {
+          ++rel;
+          continue;
+        }
+
+      if (beg [0] == '.')
+        {
+          if (len == 1)
+            continue; /* . - nop */
+
+          if (beg [1] == '.' && len == 2)
+            {
+              /* .. - back up one component, if possible */
+
+              while (res != tmpbuf->ptr)
+                if (*--res == '/')
+                  break;
+
+              continue;
+            }
+        }
+
+        errno = ENAMETOOLONG;
+        if (res + 1 + len + 1 >= tmp1)
+          return -1;
+
+        /* copy one component */
+        *res = '/';
+        memcpy (res + 1, beg, len);
+
+        /* zero-terminate, for readlink */
+        res [len + 1] = 0;
+
+        /* now check if it's a symlink */
+        linklen = eio__readlink_cached (tmpbuf->ptr, tmp1);
+
+        if (linklen < 0)
+          {
+            if (errno != EINVAL)
+              return -1;
+
+            /* it's a normal directory. hopefully */
+            res += len + 1;
+          }
+        else
+          {
+            /* yay, it was a symlink - build new path in tmp2 */
+            int rellen = strlen (rel);
+
+            errno = ENAMETOOLONG;
+            if (linklen + 1 + rellen >= EIO_PATH_MAX) /* also catch linklen >= EIO_PATH_MAX */
+              return -1;
+
+            errno = ELOOP;
+            if (!--symlinks)
+              return -1;
+
+            if (*tmp1 == '/')
+              res = tmpbuf->ptr; /* symlink resolves to an absolute path */
+
+            /* we need to be careful, as rel might point into tmp2 already */
+            memmove (tmp2 + linklen + 1, rel, rellen + 1);
+            tmp2 [linklen] = '/';
+            memcpy (tmp2, tmp1, linklen);
+
+            rel = tmp2;
+          }
+    }
+
+  /* special case for the lone root path */
+  if (res == tmpbuf->ptr)
+    *res++ = '/';
+
+  return res - (char *)tmpbuf->ptr;
+#endif
+}
+
+static signed char
+eio_dent_cmp (const eio_dirent *a, const eio_dirent *b)
+{
+  return a->score - b->score ? a->score - b->score /* works because our signed char is always 0..100 */
+       : a->inode < b->inode ? -1
+       : a->inode > b->inode ?  1
+       :                        0;
+}
+
+#define EIO_DENT_CMP(i,op,j) eio_dent_cmp (&i, &j) op 0
+
+#define EIO_SORT_CUTOFF 30 /* quite high, but performs well on many filesystems */
+#define EIO_SORT_FAST   60 /* when to only use insertion sort */
+
+static void
+eio_dent_radix_sort (eio_dirent *dents, int size, signed char score_bits, eio_ino_t inode_bits)
+{
+  unsigned char bits [9 + sizeof (eio_ino_t) * 8];
+  unsigned char *bit = bits;
+
+  assert (CHAR_BIT == 8);
+  assert (sizeof (eio_dirent) * 8 < 256);
+  assert (offsetof (eio_dirent, inode)); /* we use bit #0 as sentinel */
+  assert (offsetof (eio_dirent, score)); /* we use bit #0 as sentinel */
+
+  if (size <= EIO_SORT_FAST)
+    return;
+
+  /* first prepare an array of bits to test in our radix sort */
+  /* try to take endianness into account, as well as differences in eio_ino_t sizes */
+  /* inode_bits must contain all inodes ORed together */
+  /* which is used to skip bits that are 0 everywhere, which is very common */
+  {
+    eio_ino_t endianness;
+    int i, j;
+
+    /* we store the byte offset of byte n into byte n of "endianness" */
+    for (i = 0; i < sizeof (eio_ino_t); ++i)
+      ((unsigned char *)&endianness)[i] = i;
+
+    *bit++ = 0;
+
+    for (i = 0; i < sizeof (eio_ino_t); ++i)
+      {
+        /* shifting off the byte offsets out of "endianness" */
+        int offs = (offsetof (eio_dirent, inode) + (endianness & 0xff)) * 8;
+        endianness >>= 8;
+
+        for (j = 0; j < 8; ++j)
+          if (inode_bits & (((eio_ino_t)1) << (i * 8 + j)))
+            *bit++ = offs + j;
+      }
+
+    for (j = 0; j < 8; ++j)
+      if (score_bits & (1 << j))
+        *bit++ = offsetof (eio_dirent, score) * 8 + j;
+  }
+
+  /* now actually do the sorting (a variant of MSD radix sort) */
+  {
+    eio_dirent    *base_stk [9 + sizeof (eio_ino_t) * 8], *base;
+    eio_dirent    *end_stk  [9 + sizeof (eio_ino_t) * 8], *end;
+    unsigned char *bit_stk  [9 + sizeof (eio_ino_t) * 8];
+    int stk_idx = 0;
+
+    base_stk [stk_idx] = dents;
+    end_stk  [stk_idx] = dents + size;
+    bit_stk  [stk_idx] = bit - 1;
+
+    do
+      {
+        base = base_stk [stk_idx];
+        end  = end_stk  [stk_idx];
+        bit  = bit_stk  [stk_idx];
+
+        for (;;)
+          {
+            unsigned char O = *bit >> 3;
+            unsigned char M = 1 << (*bit & 7);
+
+            eio_dirent *a = base;
+            eio_dirent *b = end;
+
+            if (b - a < EIO_SORT_CUTOFF)
+              break;
+
+            /* now bit-partition the array on the bit */
+            /* this ugly asymmetric loop seems to perform much better than typical */
+            /* partition algos found in the literature */
+            do
+              if (!(((unsigned char *)a)[O] & M))
+                ++a;
+              else if (!(((unsigned char *)--b)[O] & M))
+                {
+                  eio_dirent tmp = *a; *a = *b; *b = tmp;
+                  ++a;
+                }
+            while (b > a);
+
+            /* next bit, or stop, if no bits left in this path */
+            if (!*--bit)
+              break;
+
+            base_stk [stk_idx] = a;
+            end_stk  [stk_idx] = end;
+            bit_stk  [stk_idx] = bit;
+            ++stk_idx;
+
+            end = a;
+          }
+      }
+    while (stk_idx--);
+  }
+}
+
+static void
+eio_dent_insertion_sort (eio_dirent *dents, int size)
+{
+  /* first move the smallest element to the front, to act as a sentinel */
+  {
+    int i;
+    eio_dirent *min = dents;
+    
+    /* the radix pre-pass ensures that the minimum element is in the first EIO_SORT_CUTOFF + 1 elements */
+    for (i = size > EIO_SORT_FAST ? EIO_SORT_CUTOFF + 1 : size; --i; )
+      if (EIO_DENT_CMP (dents [i], <, *min))
+        min = &dents [i];
+
+    /* swap elements 0 and j (minimum) */
+    {
+      eio_dirent tmp = *dents; *dents = *min; *min = tmp;
+    }
+  }
+
+  /* then do standard insertion sort, assuming that all elements are >= dents [0] */
+  {
+    eio_dirent *i, *j;
+
+    for (i = dents + 1; i < dents + size; ++i)
+      {
+        eio_dirent value = *i;
+
+        for (j = i - 1; EIO_DENT_CMP (*j, >, value); --j)
+          j [1] = j [0];
+
+        j [1] = value;
+      }
+  }
+}
+
+#ifndef EIO_SORT_LSD
+# define EIO_SORT_LSD 2048 /* when to use the lsd radix sort instead, 0 disables */
+#endif
+
+struct eio_dent_key
+{
+  unsigned long long inode;
+  unsigned int idx;
+  unsigned int score;
+};
+
+/* lsd radix sort, byte by byte, on a compact key array, */
+/* followed by a single permutation of the dents themselves */
+/* this touches every dent only twice, which pays off for large dirs */
+/* returns 0 if it couldn't sort, e.g. due to lack of memory */
+static int
+eio_dent_lsd_sort (eio_dirent *dents, int size, signed char score_bits, eio_ino_t inode_bits)
+{
+  enum { NDIGITS = sizeof (eio_ino_t) + 1 }; /* inode bytes, least significant first, then score */
+  unsigned int (*count)[256];
+  unsigned char digits [NDIGITS];
+  int ndigits = 0, ninode;
+  int sorted = 1;
+  struct eio_dent_key *src, *dst;
+  int d, i;
+
+  /* only look at bytes that are non-zero in at least one inode */
+  for (d = 0; d < sizeof (eio_ino_t); ++d)
+    if ((unsigned long long)inode_bits >> (d * 8) & 0xff)
+      digits [ndigits++] = d;
+
+  ninode = ndigits;
+
+  if (score_bits)
+    digits [ndigits++] = sizeof (eio_ino_t);
+
+  count = calloc (ndigits ? ndigits : 1, sizeof (*count));
+  src   = malloc (size * 2 * sizeof (struct eio_dent_key));
+
+  if (!count || !src)
+    {
+      free (count);
+      free (src);
+      return 0;
+    }
+
+  dst = src + size;
+
+  /* extract the keys and build all histograms in a single pass */
+  for (i = 0; i < size; ++i)
+    {
+      struct eio_dent_key *key = src + i;
+
+      if (i && eio_dent_cmp (dents + i - 1, dents + i) > 0)
+        sorted = 0;
+
+      key->inode = dents [i].inode;
+      key->idx   = i;
+      key->score = (unsigned char)dents [i].score;
+
+      for (d = 0; d < ninode; ++d)
+        ++count [d][key->inode >> (digits [d] * 8) & 0xff];
+
+      if (score_bits)
+        ++count [ninode][key->score];
+    }
+
+  /* the common case of an already sorted directory needs no work */
+  if (sorted)
+    {
+      free (count);
+      free (src);
+      return 1;
+    }
+
+  for (d = 0; d < ndigits; ++d)
+    {
+      int shift = digits [d] * 8;
+      int is_score = digits [d] == sizeof (eio_ino_t);
+      unsigned int *cnt = count [d];
+      unsigned int ofs = 0;
+
+      /* skip digits that are the same for all keys */
+      if (cnt [is_score ? src->score : src->inode >> shift & 0xff] == size)
+        continue;
+
+      for (i = 0; i < 256; ++i)
+        {
+          unsigned int c = cnt [i];
+          cnt [i] = ofs;
+          ofs += c;
+        }
+
+      if (is_score)
+        for (i = 0; i < size; ++i)
+          dst [cnt [src [i].score]++] = src [i];
+      else
+        for (i = 0; i < size; ++i)
+          dst [cnt [src [i].inode >> shift & 0xff]++] = src [i];
+
+      {
+        struct eio_dent_key *tmp = src; src = dst; dst = tmp;
+      }
+    }
+
+  free (count);
+
+  {
+    eio_dirent *perm = malloc (size * sizeof (eio_dirent));
+
+    if (perm)
+      {
+        /* gather into a new array, which reads randomly but writes sequentially */
+        for (i = 0; i < size; ++i)
+          perm [i] = dents [src [i].idx];
+
+        memcpy (dents, perm, size * sizeof (eio_dirent));
+        free (perm);
+      }
+    else
+      /* permute the dents in place, following the cycles of the permutation */
+      /* idx is set to the position itself when the dent at that position is final */
+      for (i = 0; i < size; ++i)
+        if (src [i].idx != i)
+          {
+            eio_dirent tmp = dents [i];
+            int j = i;
+
+            for (;;)
+              {
+                int k = src [j].idx;
+
+                src [j].idx = j;
+
+                if (k == i)
+                  break;
+
+                dents [j] = dents [k];
+                j = k;
+              }
+
+            dents [j] = tmp;
+          }
+  }
+
+  free (src < dst ? src : dst);
+
+  return 1;
+}
+
+static void
+eio_dent_sort (eio_dirent *dents, int size, signed char score_bits, eio_ino_t inode_bits)
+{
+  if (size <= 1)
+    return; /* our insertion sort relies on size > 0 */
+
+  if (EIO_SORT_LSD && size >= EIO_SORT_LSD)
+    if (eio_dent_lsd_sort (dents, size, score_bits, inode_bits))
+      return;
+
+  /* first we use a radix sort, but only for dirs >= EIO_SORT_FAST */
+  /* and stop sorting when the partitions are <= EIO_SORT_CUTOFF */
+  eio_dent_radix_sort (dents, size, score_bits, inode_bits);
+
+  /* use an insertion sort at the end, or for small arrays, */
+  /* as insertion sort is more efficient for small partitions */
+  eio_dent_insertion_sort (dents, size);
+}
+
+/*****************************************************************************/
+/* directory reading primitives */
+
+#if HAVE_GETDENTS64 && HAVE_AT && EIO_GETDENTS_BUFSIZE && __linux
+# define EIO_GETDENTS 1
+#else
+# define EIO_GETDENTS 0
+#endif
+
+#ifdef _WIN32
+
+  typedef WIN32_FIND_DATA eio_dirscan_ent;
+
+  struct eio_dirscan
+  {
+    HANDLE h;
+    WIN32_FIND_DATA ent;
+    int more; /* ent contains an entry not yet returned */
+  };
+
+#elif EIO_GETDENTS
+
+  /* the kernel dirent, which glibc doesn't export, but the D_* macros work on it */
+  struct eio_linux_dirent64
+  {
+    unsigned long long d_ino;
+    long long          d_off;
+    unsigned short     d_reclen;
+    unsigned char      d_type;
+    char               d_name[1];
+  };
+
+  typedef struct eio_linux_dirent64 eio_dirscan_ent;
+
+  /* read the directory directly with getdents64 into a large buffer, */
+  /* as glibc uses a tiny buffer and thus needs many syscalls on large dirs */
+  struct eio_dirscan
+  {
+    int fd;
+    char *buf;
+    int ofs, len;
+  };
+
+#else
+
+  typedef EIO_STRUCT_DIRENT eio_dirscan_ent;
+
+  struct eio_dirscan
+  {
+    DIR *dirp;
+  };
+
+#endif
+
+/* open directory for reading, tmpbuf is used as scratch space until the directory is closed */
+static int
+eio__dirscan_open (struct eio_dirscan *dir, struct etp_tmpbuf *tmpbuf, eio_wd wd, const char *path)
+{
+#ifdef _WIN32
+  int len = strlen (path);
+  char *fullpath = malloc (MAX_PATH);
+  const char *fmt;
+  const char *reqpath = wd_expand (tmpbuf, wd, path);
+
+  if (!len)
+    fmt = "./*";
+  else if (reqpath[len - 1] == '/' || reqpath[len - 1] == '\\')
+    fmt = "%s*";
+  else
+    fmt = "%s/*";
+
+  _snprintf (fullpath, MAX_PATH, fmt, reqpath);
+  dir->h = FindFirstFile (fullpath, &dir->ent);
+  dir->more = 1;
+  free (fullpath);
+
+  if (dir->h == INVALID_HANDLE_VALUE)
+   {
+     dir->more = 0;
+
+     /* should steal _dosmaperr */
+     switch (GetLastError ())
+       {
+         case ERROR_FILE_NOT_FOUND:
+           return 0; /* empty directory */
+
+         case ERROR_INVALID_NAME:
+         case ERROR_PATH_NOT_FOUND:
+         case ERROR_NO_MORE_FILES:
+           errno = ENOENT;
+           break;
+
+         case ERROR_NOT_ENOUGH_MEMORY:
+           errno = ENOMEM;
+           break;
+
+         default:
+           errno = EINVAL;
+           break;
+       }
+
+     return -1;
+   }
+
+  return 0;
+#elif EIO_GETDENTS
+  dir->buf = etp_tmpbuf_get (tmpbuf, EIO_GETDENTS_BUFSIZE);
+  dir->ofs = dir->len = 0;
+
+  if (!dir->buf)
+    return EIO_ERRNO (ENOMEM, -1);
+
+  dir->fd = openat (WD2FD (wd), path, O_CLOEXEC | O_SEARCH | O_DIRECTORY | O_NONBLOCK);
+
+  return dir->fd < 0 ? -1 : 0;
+#elif HAVE_AT
+  int fd = openat (WD2FD (wd), path, O_CLOEXEC | O_SEARCH | O_DIRECTORY | O_NONBLOCK);
+
+  if (fd < 0)
+    return -1;
+
+  dir->dirp = fdopendir (fd);
+
+  if (!dir->dirp)
+    {
+      silent_close (fd);
+      return -1;
+    }
+
+  return 0;
+#else
+  dir->dirp = opendir (wd_expand (tmpbuf, wd, path));
+
+  return dir->dirp ? 0 : -1;
+#endif
+}
+
+/* returns the next entry, or 0 with errno set on error, or 0 with errno == 0 on eof */
+static eio_dirscan_ent *
+eio__dirscan_next (struct eio_dirscan *dir)
+{
+#ifdef _WIN32
+  errno = 0;
+
+  if (dir->more)
+    {
+      dir->more = 0;
+      return &dir->ent;
+    }
+
+  return dir->h != INVALID_HANDLE_VALUE && FindNextFile (dir->h, &dir->ent) ? &dir->ent : 0;
+#elif EIO_GETDENTS
+  eio_dirscan_ent *ent;
+
+  if (dir->ofs >= dir->len)
+    {
+      dir->ofs = 0;
+      dir->len = syscall (SYS_getdents64, dir->fd, dir->buf, EIO_GETDENTS_BUFSIZE);
+
+      if (dir->len <= 0)
+        {
+          if (!dir->len)
+            errno = 0;
+
+          dir->len = 0;
+          return 0;
+        }
+    }
+
+  ent = (eio_dirscan_ent *)(dir->buf + dir->ofs);
+  dir->ofs += ent->d_reclen;
+
+  return ent;
+#else
+  errno = 0;
+  return readdir (dir->dirp);
+#endif
+}
+
+/* close the directory without disturbing errno */
+static void
+eio__dirscan_close (struct eio_dirscan *dir)
+{
+#ifdef _WIN32
+  if (dir->h != INVALID_HANDLE_VALUE)
+    FindClose (dir->h);
+#elif EIO_GETDENTS
+  silent_close (dir->fd);
+#else
+  int saved_errno = errno;
+  closedir (dir->dirp);
+  errno = saved_errno;
+#endif
+}
+
+/* the EIO_READDIR_DIRS_FIRST score of an entry, lower scores are more likely directories */
+/* len is the length of the name including the terminating 0 */
+static signed char
+eio__dent_score (const char *name, int len, unsigned char type)
+{
+  if (type == EIO_DT_DIR)
+    return 0;
+
+  if (type == EIO_DT_UNKNOWN)
+    {
+      if (*name == '.') /* leading dots are likely directories, and, in any case, rare */
+        return 1;
+      else if (!strchr (name, '.')) /* absence of dots indicate likely dirs */
+        return len <= 2 ? 4 - len : len <= 4 ? 4 : len <= 7 ? 5 : 6; /* shorter == more likely dir, but avoid too many classes */
+    }
+
+  return 7;
+}
+
+/* the EIO_DT_* type of an entry, if the system provides it */
+static unsigned char
+eio__dirscan_type (eio_dirscan_ent *entp)
+{
+  switch (D_TYPE (entp))
+    {
+      default:        return EIO_DT_UNKNOWN;
+
+      #ifdef DT_FIFO
+        case DT_FIFO: return EIO_DT_FIFO;
+      #endif
+      #ifdef DT_CHR
+        case DT_CHR:  return EIO_DT_CHR;
+      #endif
+      #ifdef DT_MPC
+        case DT_MPC:  return EIO_DT_MPC;
+      #endif
+      #ifdef DT_DIR
+        case DT_DIR:  return EIO_DT_DIR;
+      #endif
+      #ifdef DT_NAM
+        case DT_NAM:  return EIO_DT_NAM;
+      #endif
+      #ifdef DT_BLK
+        case DT_BLK:  return EIO_DT_BLK;
+      #endif
+      #ifdef DT_MPB
+        case DT_MPB:  return EIO_DT_MPB;
+      #endif
+      #ifdef DT_REG
+        case DT_REG:  return EIO_DT_REG;
+      #endif
+      #ifdef DT_NWK
+        case DT_NWK:  return EIO_DT_NWK;
+      #endif
+      #ifdef DT_CMP
+        case DT_CMP:  return EIO_DT_CMP;
+      #endif
+      #ifdef DT_LNK
+        case DT_LNK:  return EIO_DT_LNK;
+      #endif
+      #ifdef DT_SOCK
+        case DT_SOCK: return EIO_DT_SOCK;
+      #endif
+      #ifdef DT_DOOR
+        case DT_DOOR: return EIO_DT_DOOR;
+      #endif
+      #ifdef DT_WHT
+        case DT_WHT:  return EIO_DT_WHT;
+      #endif
+    }
+}
+
+#if HAVE_AT
+
+/* the fd of the open directory, for use with the *at functions */
+static int
+eio__dirscan_fd (struct eio_dirscan *dir)
+{
+#if EIO_GETDENTS
+  return dir->fd;
+#else
+  return dirfd (dir->dirp);
+#endif
+}
+
+/* like eio__dirscan_open, but reads an already open directory fd, which stays open */
+static int
+eio__dirscan_openfd (struct eio_dirscan *dir, struct etp_tmpbuf *tmpbuf, int fd)
+{
+#if EIO_GETDENTS
+  dir->buf = etp_tmpbuf_get (tmpbuf, EIO_GETDENTS_BUFSIZE);
+  dir->ofs = dir->len = 0;
+
+  if (!dir->buf)
+    return EIO_ERRNO (ENOMEM, -1);
+#endif
+
+  fd = fcntl (fd, F_DUPFD_CLOEXEC, 0);
+
+  if (fd < 0)
+    return -1;
+
+#if EIO_GETDENTS
+  dir->fd = fd;
+#else
+  dir->dirp = fdopendir (fd);
+
+  if (!dir->dirp)
+    {
+      silent_close (fd);
+      return -1;
+    }
+#endif
+
+  return 0;
+}
+
+#endif
+
+/*****************************************************************************/
+/* readdirplus: stat all entries of a directory while it is still open */
+
+#ifndef EIO_DIRSTAT_BATCH
+# define EIO_DIRSTAT_BATCH 32 /* number of entries a worker claims at a time */
+#endif
+
+/* shared by all workers stat'ing the entries of a single request */
+struct eio_dirstat
+{
+  xmutex_t lock;
+  int next; /* next entry to be claimed, locked by lock */
+  int size;
+  eio_req *req;
+  eio_dirent *dents;
+  const char *names;
+  EIO_STRUCT_STAT *stats;
+#if HAVE_AT
+  int fd;
+#else
+  const char *path; /* the directory, including a trailing slash */
+#endif
+};
+
+static unsigned char
+eio__mode_dtype (int mode)
+{
+  return S_ISREG  (mode) ? EIO_DT_REG
+       : S_ISDIR  (mode) ? EIO_DT_DIR
+  #ifdef S_ISLNK
+       : S_ISLNK  (mode) ? EIO_DT_LNK
+  #endif
+  #ifdef S_ISFIFO
+       : S_ISFIFO (mode) ? EIO_DT_FIFO
+  #endif
+  #ifdef S_ISCHR
+       : S_ISCHR  (mode) ? EIO_DT_CHR
+  #endif
+  #ifdef S_ISBLK
+       : S_ISBLK  (mode) ? EIO_DT_BLK
+  #endif
+  #ifdef S_ISSOCK
+       : S_ISSOCK (mode) ? EIO_DT_SOCK
+  #endif
+       : EIO_DT_UNKNOWN;
+}
+
+static void
+eio__dirstat_work (etp_worker *self, void *arg)
+{
+  struct eio_dirstat *ds = (struct eio_dirstat *)arg;
+#if !HAVE_AT
+  struct etp_tmpbuf pathbuf = { 0 };
+  int dirlen = strlen (ds->path);
+#endif
+
+  for (;;)
+    {
+      int i, end;
+
+      X_LOCK (ds->lock);
+      i = ds->next;
+      ds->next = i < ds->size ? i + EIO_DIRSTAT_BATCH : i;
+      X_UNLOCK (ds->lock);
+
+      if (i >= ds->size || EIO_CANCELLED (ds->req))
+        break;
+
+      end = i + EIO_DIRSTAT_BATCH < ds->size ? i + EIO_DIRSTAT_BATCH : ds->size;
+
+      for (; i < end; ++i)
+        {
+          eio_dirent *ent = ds->dents + i;
+          EIO_STRUCT_STAT *buf = ds->stats + i;
+          const char *name = ds->names + ent->nameofs;
+#if HAVE_AT
+          int res = fstatat (ds->fd, name, buf, AT_SYMLINK_NOFOLLOW);
+#else
+          int res = -1;
+          char *path = etp_tmpbuf_get (&pathbuf, dirlen + ent->namelen + 1);
+
+          if (path)
+            {
+              memcpy (path, ds->path, dirlen);
+              memcpy (path + dirlen, name, ent->namelen + 1);
+              res = lstat (path, buf);
+            }
+#endif
+
+          /* entries that vanished in the meantime get an all-zero stat buffer */
+          if (res)
+            memset (buf, 0, sizeof (*buf));
+          else if (ent->type == EIO_DT_UNKNOWN)
+            ent->type = eio__mode_dtype (buf->st_mode);
+        }
+    }
+
+#if !HAVE_AT
+  free (pathbuf.ptr);
+#endif
+}
+
+/* lstat all dents in their current order, storing the results behind the dents in ptr1 */
+static int
+eio__dirstat (eio_req *req, etp_worker *self, struct eio_dirscan *dir, eio_wd wd, const char *path, int size)
+{
+  struct eio_dirstat ds;
+  int nthreads = req->int2 > 1 ? req->int2 : 1;
+  int nbatches = (size + EIO_DIRSTAT_BATCH - 1) / EIO_DIRSTAT_BATCH;
+  int offs = (size * sizeof (eio_dirent) + 15) & ~15;
+  void *block = realloc (req->ptr1, offs + size * sizeof (EIO_STRUCT_STAT));
+
+  if (!block)
+    return EIO_ERRNO (ENOMEM, -1);
+
+  req->ptr1 = block;
+  req->offs = offs;
+
+  ds.next  = 0;
+  ds.size  = size;
+  ds.req   = req;
+  ds.dents = (eio_dirent *)req->ptr1;
+  ds.names = (const char *)req->ptr2;
+  ds.stats = EIO_READDIR_STAT_BUF (req);
+
+#if HAVE_AT
+  ds.fd = eio__dirscan_fd (dir);
+#else
+  {
+    struct etp_tmpbuf pathbuf = { 0 };
+    const char *dirpath = wd_expand (&pathbuf, wd, path);
+    int len = strlen (dirpath);
+    char *copy = malloc (len + 2);
+
+    if (copy)
+      {
+        memcpy (copy, dirpath, len);
+        copy [len    ] = '/';
+        copy [len + 1] = 0;
+      }
+
+    free (pathbuf.ptr);
+
+    if (!copy)
+      return EIO_ERRNO (ENOMEM, -1);
+
+    ds.path = copy;
+  }
+#endif
+
+  X_MUTEX_CREATE (ds.lock);
+
+  if (nthreads > nbatches)
+    nthreads = nbatches;
+
+  etp_fanout_run (EIO_POOL, self, nthreads - 1, req->pri, eio__dirstat_work, &ds);
+
+  X_MUTEX_DESTROY (ds.lock);
+
+#if !HAVE_AT
+  free ((void *)ds.path);
+#endif
+
+  if (EIO_CANCELLED (req))
+    return EIO_ERRNO (ECANCELED, -1);
+
+  return 0;
+}
+
+/* convert the dents in ptr1 (and their stat buffers) into the EIO_READDIR_COMPACT */
+/* layout, appended to the names in ptr2, so the whole result is a single block */
+static int
+eio__dirents_compact (eio_req *req, int flags, int size, int namesoffs)
+{
+  eio_dirent *dents = (eio_dirent *)req->ptr1;
+  int ino_offs  = (namesoffs + 15) & ~15;
+  int ofs_offs  = ino_offs + size * sizeof (eio_ino_t);
+  int type_offs = ofs_offs + size * sizeof (int);
+  int stat_offs = (type_offs + size + 15) & ~15;
+  int len = flags & EIO_READDIR_STAT ? stat_offs + size * sizeof (EIO_STRUCT_STAT) : type_offs + size;
+  char *block = realloc (req->ptr2, len ? len : 1); /* realloc (ptr, 0) might just free ptr */
+  int i;
+
+  if (!block)
+    return EIO_ERRNO (ENOMEM, -1);
+
+  req->ptr2 = block;
+
+  {
+    eio_ino_t *inode = (eio_ino_t *)(block + ino_offs);
+    int *nameofs = (int *)(block + ofs_offs);
+    unsigned char *type = (unsigned char *)(block + type_offs);
+
+    for (i = 0; i < size; ++i)
+      {
+        inode   [i] = dents [i].inode;
+        nameofs [i] = dents [i].nameofs;
+        type    [i] = dents [i].type;
+      }
+  }
+
+  if (flags & EIO_READDIR_STAT)
+    memcpy (block + stat_offs, EIO_READDIR_STAT_BUF (req), size * sizeof (EIO_STRUCT_STAT));
+
+  free (dents);
+
+  /* ptr1 now points into ptr2, and must not be freed */
+  req->flags &= ~EIO_FLAG_PTR1_FREE;
+  req->ptr1 = block + ino_offs;
+  req->offs = stat_offs - ino_offs;
+
+  return 0;
+}
+
+/* state of a readdir stream, shared by all chunk requests of the stream group */
+struct eio_dirstream
+{
+  eio_wd wd;
+  char *path;
+  int flags;    /* eio_readdir flags */
+  int nentries; /* maximum number of entries per chunk */
+  int pri;
+  eio_cb cb;
+  int state;
+  struct eio_dirscan dir;
+  struct etp_tmpbuf tmpbuf; /* scratch space for the dirscan, which must survive between chunks */
+};
+
+enum
+{
+  EIO_DIRSTREAM_NEW,  /* directory not yet opened */
+  EIO_DIRSTREAM_OPEN, /* directory open, more entries might follow */
+  EIO_DIRSTREAM_EOF,  /* directory closed, a final empty chunk needs to be delivered */
+  EIO_DIRSTREAM_DONE  /* final chunk delivered, or error */
+};
+
+/* read a full directory, or the next chunk of a directory stream */
+static void
+eio__scandir (eio_req *req, etp_worker *self)
+{
+  char *name, *names;
+  int namesalloc = 4096 - sizeof (void *) * 4;
+  int namesoffs = 0;
+  int flags = req->int1;
+  eio_dirent *dents = 0;
+  int dentalloc = 128;
+  int dentoffs = 0;
+  eio_ino_t inode_bits = 0;
+  struct eio_dirscan dirbuf, *dir = &dirbuf;
+  struct eio_dirstream *stream = 0;
+  int limit = -1; /* maximum number of entries to return, -1 == all */
+  eio_dirscan_ent *entp;
+  eio_wd wd = req->wd;
+  char *path = req->ptr1;
+  void *path_free = 0; /* the path is needed until the directory is closed */
+
+  req->result = -1;
+
+  /* stat'ing implies dents, and is best done in inode order */
+  if (flags & EIO_READDIR_STAT)
+    flags |= EIO_READDIR_DENTS | EIO_READDIR_STAT_ORDER;
+
+  if (flags & EIO_READDIR_COMPACT)
+    flags |= EIO_READDIR_DENTS;
+
+  if (!(flags & EIO_READDIR_DENTS))
+    flags &= ~(EIO_READDIR_DIRS_FIRST | EIO_READDIR_STAT_ORDER);
+
+  if (req->flags & EIO_FLAG_STREAM)
+    {
+      stream = (struct eio_dirstream *)req->ptr1;
+      req->ptr1 = 0;
+
+      dir   = &stream->dir;
+      limit = stream->nentries;
+      wd    = stream->wd;
+      path  = stream->path;
+
+      if (stream->state == EIO_DIRSTREAM_EOF)
+        {
+          stream->state = EIO_DIRSTREAM_DONE;
+          req->result = 0;
+          return;
+        }
+
+      if (stream->state == EIO_DIRSTREAM_NEW)
+        {
+          stream->state = EIO_DIRSTREAM_DONE;
+
+          if (eio__dirscan_open (dir, &stream->tmpbuf, stream->wd, stream->path))
+            return;
+
+          stream->state = EIO_DIRSTREAM_OPEN;
+        }
+    }
+  else if (eio__dirscan_open (dir, &self->tmpbuf, wd, path))
+    return;
+  else if (req->flags & EIO_FLAG_PTR1_FREE)
+    path_free = path;
+
+  req->flags |= EIO_FLAG_PTR1_FREE | EIO_FLAG_PTR2_FREE;
+  req->ptr1 = dents = flags ? malloc (dentalloc * sizeof (eio_dirent)) : 0;
+  req->ptr2 = names = malloc (namesalloc);
+
+  if (!names || (flags && !dents))
+    goto fail;
+
+  for (;;)
+    {
+      /* a full chunk ends the request, but keeps the directory open */
+      entp = dentoffs != limit ? eio__dirscan_next (dir) : 0;
+
+      if (!entp)
+        {
+          if (dentoffs != limit && errno)
+            goto fail;
+
+          /* sort etc. */
+          if (flags & EIO_READDIR_STAT_ORDER)
+            eio_dent_sort (dents, dentoffs, flags & EIO_READDIR_DIRS_FIRST ? 7 : 0, inode_bits);
+          else if (flags & EIO_READDIR_DIRS_FIRST)
+            if (flags & EIO_READDIR_FOUND_UNKNOWN)
+              eio_dent_sort (dents, dentoffs, 7, inode_bits); /* sort by score and inode */
+            else
+              {
+                /* in this case, all is known, and we just put dirs first and sort them */
+                eio_dirent *oth = dents + dentoffs;
+                eio_dirent *dir = dents;
+
+                /* now partition dirs to the front, and non-dirs to the back */
+                /* by walking from both sides and swapping if necessary */
+                while (oth > dir)
+                  {
+                    if (dir->type == EIO_DT_DIR)
+                      ++dir;
+                    else if ((--oth)->type == EIO_DT_DIR)
+                      {
+                        eio_dirent tmp = *dir; *dir = *oth; *oth = tmp;
+
+                        ++dir;
+                      }
+                  }
+
+                /* now sort the dirs only (dirs all have the same score) */
+                eio_dent_sort (dents, dir - dents, 0, inode_bits);
+              }
+
+          if (flags & EIO_READDIR_STAT && dentoffs)
+            {
+              if (eio__dirstat (req, self, dir, wd, path, dentoffs))
+                goto fail;
+
+              if (flags & EIO_READDIR_FOUND_UNKNOWN)
+                {
+                  int i;
+
+                  dents = (eio_dirent *)req->ptr1;
+                  flags &= ~EIO_READDIR_FOUND_UNKNOWN;
+
+                  for (i = 0; i < dentoffs; ++i)
+                    if (dents [i].type == EIO_DT_UNKNOWN)
+                      flags |= EIO_READDIR_FOUND_UNKNOWN;
+                }
+            }
+
+          if (flags & EIO_READDIR_COMPACT)
+            if (eio__dirents_compact (req, flags, dentoffs, namesoffs))
+              goto fail;
+
+          if (dentoffs != limit)
+            {
+              eio__dirscan_close (dir);
+
+              if (stream)
+                stream->state = dentoffs ? EIO_DIRSTREAM_EOF : EIO_DIRSTREAM_DONE;
+            }
+
+          req->int1   = flags;
+          req->result = dentoffs;
+
+          free (path_free);
+          return;
+        }
+
+      /* now add the entry to our list(s) */
+      name = D_NAME (entp);
+
+      /* skip . and .. entries */
+      if (name [0] != '.' || (name [1] && (name [1] != '.' || name [2])))
+        {
+          int len = D_NAMLEN (entp) + 1;
+
+          while (ecb_expect_false (namesoffs + len > namesalloc))
+            {
+              namesalloc *= 2;
+              req->ptr2 = names = realloc (names, namesalloc);
+
+              if (!names)
+                break;
+            }
+
+          if (!names)
+            goto fail;
+
+          memcpy (names + namesoffs, name, len);
+
+          if (dents)
+            {
+              struct eio_dirent *ent;
+
+              if (ecb_expect_false (dentoffs == dentalloc))
+                {
+                  dentalloc *= 2;
+                  req->ptr1 = dents = realloc (dents, dentalloc * sizeof (eio_dirent));
+
+                  if (!dents)
+                    goto fail;
+                }
+
+              ent = dents + dentoffs;
+
+              ent->nameofs = namesoffs; /* rather dirtily we store the offset in the pointer */
+              ent->namelen = len - 1;
+              ent->inode   = D_INO (entp);
+
+              inode_bits |= ent->inode;
+
+              ent->type = eio__dirscan_type (entp);
+
+              if (ent->type == EIO_DT_UNKNOWN)
+                flags |= EIO_READDIR_FOUND_UNKNOWN;
+
+              ent->score = flags & EIO_READDIR_DIRS_FIRST ? eio__dent_score (name, len, ent->type) : 7;
+            }
+
+          namesoffs += len;
+          ++dentoffs;
+        }
+
+      if (EIO_CANCELLED (req))
+        {
+          errno = ECANCELED;
+          goto fail;
+        }
+    }
+
+fail:
+  eio__dirscan_close (dir);
+  free (path_free);
+
+  if (stream)
+    stream->state = EIO_DIRSTREAM_DONE;
+}
+
+/*****************************************************************************/
+/* tree walks: streams of chunk requests that share a stack of directories */
+/* still to be read, so that up to nthreads chunks read directories in parallel */
+/* used for EIO_TREEWALK, and EIO_RMTREE and EIO_COPYTREE, which finish directories post-order */
+
+struct eio_tree_node
+{
+  struct eio_tree_node *parent; /* referenced while this node is alive */
+  struct eio_tree_node *next;   /* in the stack of directories to be read */
+  int refcnt; /* 1 + number of live children, locked by tree->lock */
+  int state;  /* EIO_TREE_NODE_*, locked by tree->lock */
+  int fd;     /* the open directory, or -1 */
+  int dfd;    /* the open destination directory for EIO_COPYTREE, or -1 */
+  int depth;  /* of the entries in this directory, starting at 1 */
+  dev_t dev;
+  ino_t ino;
+  mode_t mode; /* of the directory, applied to the copy when it is finished */
+  struct timespec times [2];
+  int namelen; /* length of the last path component */
+  int pathlen;
+  char path [1]; /* relative to the start directory, "" for the start directory itself */
+};
+
+struct eio_tree
+{
+  xmutex_t lock;
+  struct eio_tree_node *stack; /* directories to be read, locked by lock */
+  int nstack;   /* number of nodes on the stack, locked by lock */
+  int nwaiting; /* number of chunks submitted but not yet running, locked by lock */
+  int running;  /* number of chunks currently running, locked by lock */
+  int nerrors;  /* number of directories that could not be read, locked by lock */
+  int errorno;  /* the first such error, locked by lock */
+
+  int type; /* of the chunk requests */
+  eio_wd wd;
+  char *path;
+  eio_wd dwd;  /* destination for EIO_COPYTREE */
+  char *dpath;
+  int flags;
+  int maxdepth;
+  int nentries;
+  int limit;
+  int pri;
+  eio_treewalk_filter filter;
+  eio_cb cb;
+  void *data;
+  int state; /* only used by the event loop thread */
+  dev_t dev; /* of the start directory */
+};
+
+enum
+{
+  EIO_TREE_RUN, /* more chunks might follow */
+  EIO_TREE_DONE /* the final chunk has been submitted, or there was an error */
+};
+
+enum
+{
+  EIO_TREE_NODE_READ   = 0x01, /* all entries have been handled */
+  EIO_TREE_NODE_FAILED = 0x02  /* some entry could not be removed */
+};
+
+/* remember the first error, and that the directory cannot be removed */
+static void
+eio__tree_error (struct eio_tree *tree, struct eio_tree_node *node, int errorno)
+{
+  X_LOCK (tree->lock);
+
+  if (!tree->nerrors++)
+    tree->errorno = errorno;
+
+  if (node)
+    node->state |= EIO_TREE_NODE_FAILED;
+
+  X_UNLOCK (tree->lock);
+}
+
+/* drop a reference, freeing the node and maybe its parents. once a directory and all its */
+/* children are done, EIO_RMTREE removes it and EIO_COPYTREE sets the mode and times of the */
+/* copy, unless done is 0. removed directories are counted in *done */
+static void
+eio__tree_unref (struct eio_tree *tree, struct eio_tree_node *node, int *done)
+{
+  while (node)
+    {
+      struct eio_tree_node *parent = node->parent;
+      int last, state;
+
+      X_LOCK (tree->lock);
+      last = !--node->refcnt;
+      state = node->state;
+      X_UNLOCK (tree->lock);
+
+      if (!last)
+        break;
+
+      if (node->fd >= 0)
+        silent_close (node->fd);
+
+#if HAVE_AT
+      if (node->dfd >= 0)
+        {
+          if (done && (fchmod (node->dfd, node->mode & 07777) || futimens (node->dfd, node->times)))
+            eio__tree_error (tree, 0, errno);
+
+          silent_close (node->dfd);
+        }
+
+      if (tree->type == EIO_RMTREE && done)
+        {
+          if (state != EIO_TREE_NODE_READ)
+            {
+              /* the error has already been reported */
+              if (parent)
+                {
+                  X_LOCK (tree->lock);
+                  parent->state |= EIO_TREE_NODE_FAILED;
+                  X_UNLOCK (tree->lock);
+                }
+            }
+          else if (unlinkat (parent ? parent->fd : WD2FD (tree->wd),
+                             parent ? node->path + node->pathlen - node->namelen : tree->path,
+                             AT_REMOVEDIR))
+            eio__tree_error (tree, parent, errno);
+          else
+            ++*done;
+        }
+#endif
+
+      free (node);
+
+      /* the parent is now freed as well, if this was its last child */
+      node = parent;
+    }
+}
+
+/* file copies of all EIO_COPYTREE requests are limited per destination device */
+struct eio_devslot
+{
+  struct eio_devslot *next;
+  dev_t dev;
+  unsigned int active;
+};
+
+static xmutex_t eio_devslot_lock = X_MUTEX_INIT;
+static xcond_t eio_devslot_wait = X_COND_INIT;
+static struct eio_devslot *eio_devslots; /* devices with active copies, locked by eio_devslot_lock */
+static unsigned int eio_max_device_copies;
+
+void ecb_cold
+eio_set_max_device_copies (unsigned int ncopies)
+{
+  X_LOCK (eio_devslot_lock);
+  eio_max_device_copies = ncopies;
+  X_COND_BROADCAST (eio_devslot_wait);
+  X_UNLOCK (eio_devslot_lock);
+}
+
+#if HAVE_AT
+
+/* wait until another file may be copied to dev */
+static void
+eio__devslot_acquire (dev_t dev)
+{
+  struct eio_devslot *slot;
+
+  X_LOCK (eio_devslot_lock);
+
+  for (;;)
+    {
+      for (slot = eio_devslots; slot; slot = slot->next)
+        if (slot->dev == dev)
+          break;
+
+      if (!slot || !eio_max_device_copies || slot->active < eio_max_device_copies)
+        break;
+
+      X_COND_WAIT (eio_devslot_wait, eio_devslot_lock);
+    }
+
+  if (!slot && (slot = malloc (sizeof (*slot))))
+    {
+      slot->next   = eio_devslots;
+      slot->dev    = dev;
+      slot->active = 0;
+      eio_devslots = slot;
+    }
+
+  /* without memory, we simply do not limit */
+  if (slot)
+    ++slot->active;
+
+  X_UNLOCK (eio_devslot_lock);
+}
+
+static void
+eio__devslot_release (dev_t dev)
+{
+  struct eio_devslot **prev, *slot;
+
+  X_LOCK (eio_devslot_lock);
+
+  for (prev = &eio_devslots; (slot = *prev); prev = &slot->next)
+    if (slot->dev == dev)
+      {
+        if (!--slot->active)
+          {
+            *prev = slot->next;
+            free (slot);
+          }
+
+        X_COND_BROADCAST (eio_devslot_wait);
+        break;
+      }
+
+  X_UNLOCK (eio_devslot_lock);
+}
+
+#endif
+
+#if HAVE_AT
+
+/* the output of a tree walk chunk, in eio_readdir format, with paths as names */
+struct eio_tree_out
+{
+  eio_dirent *dents;
+  int dentalloc, dentoffs;
+  char *names;
+  int namesalloc, namesoffs;
+};
+
+/* reserve space for an entry with a path of len bytes, including the trailing 0 */
+static eio_dirent *
+eio__tree_out_add (struct eio_tree_out *out, int len)
+{
+  while (ecb_expect_false (out->namesoffs + len > out->namesalloc))
+    {
+      char *names = realloc (out->names, out->namesalloc *= 2);
+
+      if (!names)
+        return 0;
+
+      out->names = names;
+    }
+
+  if (ecb_expect_false (out->dentoffs == out->dentalloc))
+    {
+      eio_dirent *dents = realloc (out->dents, (out->dentalloc *= 2) * sizeof (eio_dirent));
+
+      if (!dents)
+        return 0;
+
+      out->dents = dents;
+    }
+
+  return out->dents + out->dentoffs;
+}
+
+/* open a directory node, returns 0 if the directory should be skipped */
+static int
+eio__tree_open (struct eio_tree *tree, struct eio_tree_node *node)
+{
+  int dirfd = node->parent ? node->parent->fd : WD2FD (tree->wd);
+  const char *name = node->parent ? node->path + node->pathlen - node->namelen : tree->path;
+  int oflags = O_CLOEXEC | O_SEARCH | O_DIRECTORY | O_NONBLOCK;
+  EIO_STRUCT_STAT buf;
+
+  if ((node->parent || tree->type == EIO_RMTREE) && !(tree->flags & EIO_TREEWALK_FOLLOW))
+    oflags |= O_NOFOLLOW;
+
+  node->fd = openat (dirfd, name, oflags);
+
+  if (node->fd < 0)
+    return -1;
+
+  if (tree->flags & (EIO_TREEWALK_XDEV | EIO_TREEWALK_FOLLOW))
+    {
+      struct eio_tree_node *anc;
+
+      if (fstat (node->fd, &buf))
+        return -1;
+
+      node->dev = buf.st_dev;
+      node->ino = buf.st_ino;
+
+      if (!node->parent)
+        tree->dev = buf.st_dev;
+      else if (tree->flags & EIO_TREEWALK_XDEV && buf.st_dev != tree->dev)
+        return 0;
+
+      /* symlink loops lead back to one of our ancestors */
+      if (tree->flags & EIO_TREEWALK_FOLLOW)
+        for (anc = node->parent; anc; anc = anc->parent)
+          if (anc->dev == node->dev && anc->ino == node->ino)
+            return 0;
+    }
+
+  return 1;
+}
+
+/* create a node for the subdirectory name (of namelen bytes) of node */
+static struct eio_tree_node *
+eio__tree_child (struct eio_tree_node *node, const char *name, int namelen)
+{
+  int len = node->pathlen + !!node->pathlen + namelen;
+  struct eio_tree_node *child = malloc (sizeof (struct eio_tree_node) + len);
+
+  if (!child)
+    return 0;
+
+  child->parent  = node;
+  child->next    = 0;
+  child->refcnt  = 1;
+  child->state   = 0;
+  child->fd      = -1;
+  child->dfd     = -1;
+  child->depth   = node->depth + 1;
+  child->dev     = 0;
+  child->ino     = 0;
+  child->namelen = namelen;
+  child->pathlen = len;
+
+  memcpy (child->path, node->path, node->pathlen);
+  if (node->pathlen)
+    child->path [node->pathlen] = '/';
+  memcpy (child->path + len - namelen, name, namelen + 1);
+
+  return child;
+}
+
+/* push a list of n children of node onto the stack */
+static void
+eio__tree_push (struct eio_tree *tree, struct eio_tree_node *node, struct eio_tree_node *first, struct eio_tree_node *last, int n)
+{
+  if (!first)
+    return;
+
+  X_LOCK (tree->lock);
+  node->refcnt += n;
+  last->next = tree->stack;
+  tree->stack = first;
+  tree->nstack += n;
+  X_UNLOCK (tree->lock);
+}
+
+/* read the directory of a node, adding all entries to out, and all subdirectories to the stack */
+static int
+eio__tree_read (eio_req *req, etp_worker *self, struct eio_tree *tree, struct eio_tree_node *node, struct eio_tree_out *out)
+{
+  struct eio_dirscan dir;
+  eio_dirscan_ent *entp;
+  struct eio_tree_node *first = 0, *last = 0;
+  int nchildren = 0;
+  int res = node->fd >= 0 ? 1 : eio__tree_open (tree, node);
+
+  if (res <= 0)
+    return res;
+
+  if (eio__dirscan_openfd (&dir, &self->tmpbuf, node->fd))
+    return -1;
+
+  while ((entp = eio__dirscan_next (&dir)))
+    {
+      char *name = D_NAME (entp);
+      int namelen, len, action;
+      eio_dirent *ent;
+
+      /* skip . and .. entries */
+      if (name [0] == '.' && (!name [1] || (name [1] == '.' && !name [2])))
+        continue;
+
+      if (EIO_CANCELLED (req))
+        {
+          errno = ECANCELED;
+          break;
+        }
+
+      namelen = D_NAMLEN (entp);
+      len = node->pathlen + !!node->pathlen + namelen;
+
+      ent = eio__tree_out_add (out, len + 1);
+
+      if (!ent)
+        {
+          errno = ENOMEM;
+          break;
+        }
+
+      {
+        char *path = out->names + out->namesoffs;
+
+        memcpy (path, node->path, node->pathlen);
+        path += node->pathlen;
+
+        if (node->pathlen)
+          *path++ = '/';
+
+        memcpy (path, name, namelen + 1);
+      }
+
+      ent->nameofs = out->namesoffs;
+      ent->namelen = len;
+      ent->inode   = D_INO (entp);
+      ent->type    = eio__dirscan_type (entp);
+      ent->score   = 0;
+
+      /* we need to know which entries are directories */
+      if (ent->type == EIO_DT_UNKNOWN)
+        {
+          EIO_STRUCT_STAT buf;
+
+          if (!fstatat (node->fd, name, &buf, AT_SYMLINK_NOFOLLOW))
+            ent->type = eio__mode_dtype (buf.st_mode);
+        }
+
+      action = tree->filter ? tree->filter (out->names + ent->nameofs, ent, tree->data) : 0;
+
+      if (!(action & EIO_TREEWALK_SKIP))
+        {
+          out->namesoffs += len + 1;
+          ++out->dentoffs;
+        }
+
+      if (action & EIO_TREEWALK_PRUNE)
+        continue;
+
+      if (tree->maxdepth > 0 && node->depth >= tree->maxdepth)
+        continue;
+
+      if (ent->type == EIO_DT_LNK && tree->flags & EIO_TREEWALK_FOLLOW)
+        {
+          EIO_STRUCT_STAT buf;
+
+          if (fstatat (node->fd, name, &buf, 0) || !S_ISDIR (buf.st_mode))
+            continue;
+        }
+      else if (ent->type != EIO_DT_DIR)
+        continue;
+
+      /* remember the subdirectory */
+      {
+        struct eio_tree_node *child = eio__tree_child (node, name, namelen);
+
+        if (!child)
+          {
+            errno = ENOMEM;
+            break;
+          }
+
+        if (last)
+          last->next = child;
+        else
+          first = child;
+
+        last = child;
+        ++nchildren;
+      }
+    }
+
+  eio__dirscan_close (&dir);
+
+  /* push the subdirectories, even on errors, so they are freed properly */
+  eio__tree_push (tree, node, first, last, nchildren);
+
+  return entp || errno ? -1 : 1;
+}
+
+/* remove all entries of the directory of a node, pushing all subdirectories to the stack */
+/* out is only used as scratch space */
+static int
+eio__tree_remove (eio_req *req, etp_worker *self, struct eio_tree *tree, struct eio_tree_node *node, struct eio_tree_out *out, int *removed)
+{
+  struct eio_dirscan dir;
+  eio_dirscan_ent *entp;
+  struct eio_tree_node *first = 0, *last = 0;
+  int nchildren = 0;
+  eio_ino_t inode_bits = 0;
+  int i, phase, res = eio__tree_open (tree, node);
+
+  if (res < 0 && (errno == ENOTDIR || errno == ELOOP))
+    {
+      /* not (or no longer) a directory, or a symlink, so just unlink it */
+      if (unlinkat (node->parent ? node->parent->fd : WD2FD (tree->wd),
+                    node->parent ? node->path + node->pathlen - node->namelen : tree->path, 0))
+        return -1;
+
+      ++*removed;
+      return 1;
+    }
+
+  if (res <= 0)
+    return res ? res : EIO_ERRNO (EXDEV, -1);
+
+  if (eio__dirscan_openfd (&dir, &self->tmpbuf, node->fd))
+    return -1;
+
+  /* first read the whole directory, so we can find the directories first */
+  out->dentoffs = out->namesoffs = 0;
+
+  while ((entp = eio__dirscan_next (&dir)))
+    {
+      char *name = D_NAME (entp);
+      int len;
+      eio_dirent *ent;
+
+      /* skip . and .. entries */
+      if (name [0] == '.' && (!name [1] || (name [1] == '.' && !name [2])))
+        continue;
+
+      len = D_NAMLEN (entp) + 1;
+      ent = eio__tree_out_add (out, len);
+
+      if (!ent)
+        {
+          errno = ENOMEM;
+          break;
+        }
+
+      memcpy (out->names + out->namesoffs, name, len);
+
+      ent->nameofs = out->namesoffs;
+      ent->namelen = len - 1;
+      ent->inode   = D_INO (entp);
+      ent->type    = eio__dirscan_type (entp);
+      ent->score   = eio__dent_score (name, len, ent->type);
+
+      inode_bits |= ent->inode;
+
+      out->namesoffs += len;
+      ++out->dentoffs;
+    }
+
+  eio__dirscan_close (&dir);
+
+  if (entp || errno)
+    return -1;
+
+  /* likely directories come first, and in inode order within each class */
+  eio_dent_sort (out->dents, out->dentoffs, 7, inode_bits);
+
+  /* queue the (likely) directories early, so other chunks can start on them */
+  /* then unlink everything else, which also finds the remaining directories */
+  for (phase = 0; phase < 2; ++phase)
+    {
+      for (i = 0; i < out->dentoffs; ++i)
+        {
+          eio_dirent *ent = out->dents + i;
+          char *name = out->names + ent->nameofs;
+
+          if (EIO_CANCELLED (req))
+            {
+              eio__tree_push (tree, node, first, last, nchildren);
+              return EIO_ERRNO (ECANCELED, -1);
+            }
+
+          if (ent->score < 0) /* already handled */
+            continue;
+
+          if (!phase)
+            {
+              if (ent->score == 7)
+                break;
+
+              if (ent->type == EIO_DT_UNKNOWN)
+                {
+                  EIO_STRUCT_STAT buf;
+
+                  if (!fstatat (node->fd, name, &buf, AT_SYMLINK_NOFOLLOW))
+                    ent->type = eio__mode_dtype (buf.st_mode);
+                }
+
+              if (ent->type != EIO_DT_DIR)
+                continue;
+            }
+          else if (ent->type != EIO_DT_DIR)
+            {
+              if (!unlinkat (node->fd, name, 0))
+                {
+                  ++*removed;
+                  continue;
+                }
+
+              /* linux uses EISDIR, posix EPERM, when trying to unlink directories */
+              if (errno == EISDIR || errno == EPERM)
+                {
+                  EIO_STRUCT_STAT buf;
+
+                  if (!fstatat (node->fd, name, &buf, AT_SYMLINK_NOFOLLOW) && S_ISDIR (buf.st_mode))
+                    errno = 0;
+                  else
+                    errno = errno ? errno : EPERM;
+                }
+
+              if (errno)
+                {
+                  eio__tree_error (tree, node, errno);
+                  continue;
+                }
+            }
+
+          /* a directory, remember it */
+          {
+            struct eio_tree_node *child = eio__tree_child (node, name, ent->namelen);
+
+            ent->score = -1;
+
+            if (!child)
+              {
+                eio__tree_push (tree, node, first, last, nchildren);
+                return EIO_ERRNO (ENOMEM, -1);
+              }
+
+            if (last)
+              last->next = child;
+            else
+              first = child;
+
+            last = child;
+            ++nchildren;
+          }
+        }
+
+      eio__tree_push (tree, node, first, last, nchildren);
+      first = last = 0;
+      nchildren = 0;
+    }
+
+  X_LOCK (tree->lock);
+  node->state |= EIO_TREE_NODE_READ;
+  X_UNLOCK (tree->lock);
+
+  return 1;
+}
+
+/* copy a single non-directory entry, returns the number of bytes copied, or -1 */
+static off_t
+eio__tree_copyent (struct eio_tree *tree, etp_worker *self, int sfd, const char *sname, int dfd, const char *dname, unsigned char type, int follow)
+{
+  EIO_STRUCT_STAT buf;
+  struct timespec times [2];
+  off_t res;
+
+  if (type == EIO_DT_REG || (type == EIO_DT_LNK && follow))
+    {
+      int ifd, ofd;
+
+      ifd = openat (sfd, sname, O_RDONLY | O_CLOEXEC | O_NONBLOCK | (follow ? 0 : O_NOFOLLOW));
+
+      if (ifd < 0)
+        {
+          /* a symlink we were asked to follow, but which is dangling, is copied as a symlink */
+          if (type == EIO_DT_LNK && errno == ENOENT)
+            goto symlink;
+
+          return -1;
+        }
+
+      if (fstat (ifd, &buf))
+        {
+          silent_close (ifd);
+          return -1;
+        }
+
+      if (!S_ISREG (buf.st_mode))
+        {
+          silent_close (ifd);
+          goto special;
+        }
+
+      ofd = openat (dfd, dname, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC | O_NOFOLLOW, 0600);
+
+      if (ofd < 0)
+        {
+          silent_close (ifd);
+          return -1;
+        }
+
+      {
+        EIO_STRUCT_STAT obuf;
+
+        if (fstat (ofd, &obuf))
+          res = -1;
+        else
+          {
+            eio__devslot_acquire (obuf.st_dev);
+            res = eio__copyfile (ofd, ifd, tree->flags & EIO_COPYTREE_NOREFLINK ? EIO_COPYFILE_NOREFLINK : 0, self);
+            eio__devslot_release (obuf.st_dev);
+          }
+      }
+
+      times [0] = buf.st_atim;
+      times [1] = buf.st_mtim;
+
+      if (res >= 0 && (fchmod (ofd, buf.st_mode & 07777) || futimens (ofd, times)))
+        res = -1;
+
+      silent_close (ifd);
+
+      if (close (ofd) && res >= 0)
+        res = -1;
+
+      return res;
+    }
+
+  if (fstatat (sfd, sname, &buf, AT_SYMLINK_NOFOLLOW))
+    return -1;
+
+  if (S_ISLNK (buf.st_mode))
+    {
+      char *target;
+      eio_ssize_t len;
+
+    symlink:
+      target = etp_tmpbuf_get (&self->tmpbuf, EIO_PATH_MAX);
+
+      if (!target)
+        return EIO_ERRNO (ENOMEM, -1);
+
+      len = readlinkat (sfd, sname, target, EIO_PATH_MAX);
+
+      if (len < 0)
+        return -1;
+
+      if (len == EIO_PATH_MAX)
+        return EIO_ERRNO (ENAMETOOLONG, -1);
+
+      target [len] = 0;
+
+      /* replace existing entries, just like files are overwritten */
+      if (symlinkat (target, dfd, dname) && (errno != EEXIST || unlinkat (dfd, dname, 0) || symlinkat (target, dfd, dname)))
+        return -1;
+
+      if (fstatat (sfd, sname, &buf, AT_SYMLINK_NOFOLLOW))
+        return 0; /* gone already */
+
+      times [0] = buf.st_atim;
+      times [1] = buf.st_mtim;
+
+      /* some systems cannot change the times of symlinks */
+      utimensat (dfd, dname, times, AT_SYMLINK_NOFOLLOW);
+
+      return 0;
+    }
+
+  if (S_ISDIR (buf.st_mode))
+    return 0; /* directories are copied by their own node */
+
+special:
+  /* fifos, devices and sockets */
+  if (mknodat (dfd, dname, buf.st_mode, buf.st_rdev) && (errno != EEXIST || unlinkat (dfd, dname, 0) || mknodat (dfd, dname, buf.st_mode, buf.st_rdev)))
+    return -1;
+
+  times [0] = buf.st_atim;
+  times [1] = buf.st_mtim;
+
+  if (fchmodat (dfd, dname, buf.st_mode & 07777, 0) || utimensat (dfd, dname, times, 0))
+    return -1;
+
+  return 0;
+}
+
+/* the entries of a directory being copied, shared by helper threads */
+struct eio_tree_copy
+{
+  xmutex_t lock;
+  int next; /* next entry to be claimed, locked by lock */
+  int ncopied; /* locked by lock */
+  off_t bytes; /* locked by lock */
+  eio_req *req;
+  struct eio_tree *tree;
+  struct eio_tree_node *node;
+  struct eio_tree_out *out;
+};
+
+static void
+eio__tree_copy_work (etp_worker *self, void *arg)
+{
+  struct eio_tree_copy *tc = (struct eio_tree_copy *)arg;
+  struct eio_tree_node *node = tc->node;
+
+  for (;;)
+    {
+      eio_dirent *ent;
+      const char *name;
+      off_t res;
+      int i;
+
+      X_LOCK (tc->lock);
+      i = tc->next;
+      tc->next = i < tc->out->dentoffs ? i + 1 : i;
+      X_UNLOCK (tc->lock);
+
+      if (i >= tc->out->dentoffs || EIO_CANCELLED (tc->req))
+        break;
+
+      ent = tc->out->dents + i;
+
+      /* directories (and symlinks to them, when following symlinks) are nodes of their own */
+      if (ent->type == EIO_DT_DIR || ent->score)
+        continue;
+
+      /* the names are paths relative to the start directory */
+      name = tc->out->names + ent->nameofs + node->pathlen + !!node->pathlen;
+      res = eio__tree_copyent (tc->tree, self, node->fd, name, node->dfd, name, ent->type, tc->tree->flags & EIO_TREEWALK_FOLLOW);
+
+      if (res < 0)
+        eio__tree_error (tc->tree, node, errno);
+
+      X_LOCK (tc->lock);
+      if (res >= 0)
+        {
+          ++tc->ncopied;
+          tc->bytes += res;
+        }
+      X_UNLOCK (tc->lock);
+    }
+}
+
+/* create the copy of a directory (not yet with its final mode), then copy all its entries */
+static int
+eio__tree_copy (eio_req *req, etp_worker *self, struct eio_tree *tree, struct eio_tree_node *node, struct eio_tree_out *out, int *copied, off_t *bytes)
+{
+  int dirfd = node->parent ? node->parent->dfd : WD2FD (tree->dwd);
+  const char *name = node->parent ? node->path + node->pathlen - node->namelen : tree->dpath;
+  EIO_STRUCT_STAT buf;
+  struct eio_tree_copy tc;
+  int res = eio__tree_open (tree, node);
+
+  if (res < 0)
+    {
+      off_t len;
+
+      /* the start "directory" is a file, so simply copy it */
+      if (node->parent || errno != ENOTDIR)
+        return -1;
+
+      if (fstatat (WD2FD (tree->wd), tree->path, &buf, 0))
+        return -1;
+
+      len = eio__tree_copyent (tree, self, WD2FD (tree->wd), tree->path, WD2FD (tree->dwd), tree->dpath, eio__mode_dtype (buf.st_mode), 1);
+
+      if (len < 0)
+        return -1;
+
+      ++*copied;
+      *bytes += len;
+      return 1;
+    }
+
+  if (fstat (node->fd, &buf))
+    return -1;
+
+  node->mode      = buf.st_mode;
+  node->times [0] = buf.st_atim;
+  node->times [1] = buf.st_mtim;
+
+  /* the copy stays writable for us until it is finished */
+  if (mkdirat (dirfd, name, 0700) && errno != EEXIST)
+    return -1;
+
+  node->dfd = openat (dirfd, name, O_CLOEXEC | O_SEARCH | O_DIRECTORY | O_NOFOLLOW | O_NONBLOCK);
+
+  if (node->dfd < 0)
+    return -1;
+
+  ++*copied;
+
+  /* directories on other filesystems, or looping back, are copied empty */
+  if (!res)
+    return 1;
+
+  out->dentoffs = out->namesoffs = 0;
+
+  res = eio__tree_read (req, self, tree, node, out);
+
+  if (res < 0)
+    return res;
+
+  /* mark symlinks that were followed to directories, they have been pushed as nodes */
+  if (tree->flags & EIO_TREEWALK_FOLLOW)
+    {
+      int i;
+
+      for (i = 0; i < out->dentoffs; ++i)
+        if (out->dents [i].type == EIO_DT_LNK)
+          {
+            const char *path = out->names + out->dents [i].nameofs;
+
+            if (!fstatat (node->fd, path + node->pathlen + !!node->pathlen, &buf, 0) && S_ISDIR (buf.st_mode))
+              out->dents [i].score = 1;
+          }
+    }
+
+  X_MUTEX_CREATE (tc.lock);
+  tc.next    = 0;
+  tc.ncopied = 0;
+  tc.bytes   = 0;
+  tc.req     = req;
+  tc.tree    = tree;
+  tc.node    = node;
+  tc.out     = out;
+
+  etp_fanout_run (EIO_POOL, self, out->dentoffs > 1 ? tree->limit - 1 : 0, req->pri, eio__tree_copy_work, &tc);
+
+  X_MUTEX_DESTROY (tc.lock);
+
+  *copied += tc.ncopied;
+  *bytes  += tc.bytes;
+
+  if (EIO_CANCELLED (req))
+    return EIO_ERRNO (ECANCELED, -1);
+
+  return 1;
+}
+
+/* read directories until the chunk is full, or there are no more directories to read */
+static void
+eio__treewalk (eio_req *req, etp_worker *self)
+{
+  struct eio_tree *tree = (struct eio_tree *)req->ptr1;
+  struct eio_tree_out out;
+  int more, done = 0; /* entries removed or copied */
+  off_t bytes = 0;
+
+  req->ptr1 = 0;
+  req->result = -1;
+
+  /* the final chunk merely reports unreadable directories */
+  if (req->int3)
+    {
+      req->result = 0;
+      req->int2 = tree->nerrors;
+      errno = tree->errorno;
+      return;
+    }
+
+  X_LOCK (tree->lock);
+  --tree->nwaiting;
+  ++tree->running;
+  X_UNLOCK (tree->lock);
+
+  out.dentoffs   = 0;
+  out.namesoffs  = 0;
+  out.dentalloc  = 128;
+  out.namesalloc = 4096 - sizeof (void *) * 4;
+
+  req->flags |= EIO_FLAG_PTR1_FREE | EIO_FLAG_PTR2_FREE;
+  req->ptr1 = out.dents = malloc (out.dentalloc * sizeof (eio_dirent));
+  req->ptr2 = out.names = malloc (out.namesalloc);
+
+  if (!out.dents || !out.names)
+    errno = ENOMEM;
+  else
+    for (;;)
+      {
+        struct eio_tree_node *node;
+        int nstack, res;
+
+        if (EIO_CANCELLED (req))
+          {
+            errno = ECANCELED;
+            break;
+          }
+
+        X_LOCK (tree->lock);
+
+        node = tree->stack;
+
+        if (node)
+          {
+            tree->stack = node->next;
+            --tree->nstack;
+          }
+
+        nstack = tree->nstack;
+        X_UNLOCK (tree->lock);
+
+        if (!node)
+          {
+            req->result = tree->type == EIO_TREEWALK ? out.dentoffs : done;
+            break;
+          }
+
+        res = tree->type == EIO_RMTREE   ? eio__tree_remove (req, self, tree, node, &out, &done)
+            : tree->type == EIO_COPYTREE ? eio__tree_copy   (req, self, tree, node, &out, &done, &bytes)
+            :                              eio__tree_read   (req, self, tree, node, &out);
+
+        req->ptr1 = out.dents;
+        req->ptr2 = out.names;
+
+        if (res < 0)
+          {
+            /* errors in the start directory end the walk, others are remembered */
+            if (!node->parent || errno == ENOMEM || errno == ECANCELED)
+              {
+                eio__tree_unref (tree, node, &done);
+                break;
+              }
+
+            eio__tree_error (tree, 0, errno);
+          }
+
+        /* return early when there is work for more chunks, so they can be started */
+        X_LOCK (tree->lock);
+        more = tree->nstack > nstack && tree->running < tree->limit;
+        X_UNLOCK (tree->lock);
+
+        eio__tree_unref (tree, node, &done);
+
+        if ((tree->type == EIO_TREEWALK ? out.dentoffs : done) >= tree->nentries || more)
+          {
+            req->result = tree->type == EIO_TREEWALK ? out.dentoffs : done;
+            break;
+          }
+      }
+
+  X_LOCK (tree->lock);
+  --tree->running;
+  X_UNLOCK (tree->lock);
+
+  /* removals and copies only report counts */
+  if (tree->type != EIO_TREEWALK)
+    {
+      req->offs = bytes;
+      req->flags &= ~(EIO_FLAG_PTR1_FREE | EIO_FLAG_PTR2_FREE);
+      free (out.dents); req->ptr1 = 0;
+      free (out.names); req->ptr2 = 0;
+    }
+}
+
+#endif
+
+/*****************************************************************************/
+/* working directory stuff */
+/* various deficiencies in the posix 2008 api force us to */
+/* keep the absolute path in string form at all times */
+/* fuck yeah. */
+
+#if !HAVE_AT
+
+/* a bit like realpath, but usually faster because it doesn't have to return */
+/* an absolute or canonical path */
+static const char *
+wd_expand (struct etp_tmpbuf *tmpbuf, eio_wd wd, const char *path)
+{
+  if (!wd || *path == '/')
+    return path;
+
+  if (path [0] == '.' && !path [1])
+    return wd->str;
+
+  {
+    int l1 = wd->len;
+    int l2 = strlen (path);
+
+    char *res = etp_tmpbuf_get (tmpbuf, l1 + l2 + 2);
+
+    memcpy (res, wd->str, l1);
+    res [l1] = '/';
+    memcpy (res + l1 + 1, path, l2 + 1);
+
+    return res;
+  }
+}
+
+#endif
+
+static eio_wd
+eio__wd_open_sync (struct etp_tmpbuf *tmpbuf, eio_wd wd, const char *path)
+{
+  int fd;
+  eio_wd res;
+  int len = eio__realpath (tmpbuf, wd, path);
+
+  if (len < 0)
+    return EIO_INVALID_WD;
+
+#if HAVE_AT
+  fd = openat (WD2FD (wd), path, O_CLOEXEC | O_SEARCH | O_DIRECTORY | O_NONBLOCK);
+
+  /* 0 is a valid fd, but we use it for EIO_CWD, so in the very unlikely */
+  /* case of fd 0 being available (almost certainly an a pplication bug) */
+  /* make sure we use another fd value */
+  #if EIO_CWD
+    error EIO_CWD must be 0
+  #endif
+  if (ecb_expect_false (fd == 0))
+    {
+      int fd2 = fcntl (fd, F_DUPFD_CLOEXEC ? F_DUPFD_CLOEXEC : F_DUPFD);
+      fcntl (fd2, F_SETFD, FD_CLOEXEC);
+      eio__close (fd);
+      fd = fd2;
+    }
+
+  if (fd < 0)
+    return EIO_INVALID_WD;
+#endif
+
+  res = malloc (sizeof (*res) + len); /* one extra 0-byte */
+
+#if HAVE_AT
+  res->fd = fd;
+#endif
+
+  res->len = len;
+  memcpy (res->str, tmpbuf->ptr, len);
+  res->str [len] = 0;
+
+  return res;
+}
+
+eio_wd
+eio_wd_open_sync (eio_wd wd, const char *path)
+{
+  struct etp_tmpbuf tmpbuf = { 0 };
+  wd = eio__wd_open_sync (&tmpbuf, wd, path);
+  free (tmpbuf.ptr);
+
+  return wd;
+}
+
+static void eio__statcache_forget (eio_wd wd);
+
+void
+eio_wd_close_sync (eio_wd wd)
+{
+  if (wd != EIO_INVALID_WD && wd != EIO_CWD)
+    {
+      eio__statcache_forget (wd);
+
+      #if HAVE_AT
+      eio__close (wd->fd);
+      #endif
+      free (wd);
+    }
+}
+
+#if HAVE_AT
+
+static int
+eio__renameat2 (int olddirfd, const char *oldpath, int newdirfd, const char *newpath, unsigned int flags)
+{
+#if HAVE_RENAMEAT2
+  return syscall (SYS_renameat2, olddirfd, oldpath, newdirfd, newpath, flags);
+#else
+  if (flags)
+    return EIO_ENOSYS ();
+
+  return renameat (olddirfd, oldpath, newdirfd, newpath);
+#endif
+}
+
+/* they forgot these */
+
+static int
+eio__truncateat (int dirfd, const char *path, off_t length)
+{
+  int fd = openat (dirfd, path, O_WRONLY | O_CLOEXEC | O_NONBLOCK);
+  int res;
+
+  if (fd < 0)
+    return fd;
+
+  res = ftruncate (fd, length);
+  silent_close (fd);
+  return res;
+}
+
+static int
+eio__statvfsat (int dirfd, const char *path, struct statvfs *buf)
+{
+  int fd = openat (dirfd, path, O_SEARCH | O_CLOEXEC | O_NONBLOCK);
+  int res;
+
+  if (fd < 0)
+    return fd;
+
+  res = fstatvfs (fd, buf);
+  silent_close (fd);
+  return res;
+}
+
+#endif
+
+/*****************************************************************************/
+
+#define ALLOC(len)				\
+  if (!req->ptr2)				\
+    {						\
+      X_LOCK (EIO_POOL->wrklock);		\
+      req->flags |= EIO_FLAG_PTR2_FREE;		\
+      X_UNLOCK (EIO_POOL->wrklock);		\
+      req->ptr2 = malloc (len);			\
+      if (!req->ptr2)				\
+        {					\
+          errno       = ENOMEM;			\
+          req->result = -1;			\
+          goto alloc_fail;			\
+        }					\
+    }
+
+/*****************************************************************************/
+
+/* large preads and pwrites are split into chunks of this size, which idle workers */
+/* transfer in parallel, 0 disables this */
+static size_t eio_io_chunk_size;
+
+void ecb_cold
+eio_set_io_chunk_size (size_t bytes)
+{
+  eio_io_chunk_size = bytes;
+}
+
+struct eio_chunked
+{
+  xmutex_t lock;
+  off_t next;    /* start of the next chunk to be claimed, locked by lock */
+  off_t end;     /* end of the transfer, or where a chunk came up short, locked by lock */
+  int errorno;   /* error of the chunk that came up short, or 0, locked by lock */
+  int writing;
+  int fd;
+  char *buf;     /* corresponds to offset */
+  off_t offset;
+  size_t chunk;
+};
+
+static void
+eio__chunked_work (etp_worker *self, void *arg)
+{
+  struct eio_chunked *ck = (struct eio_chunked *)arg;
+
+  for (;;)
+    {
+      off_t start, end, pos;
+      eio_ssize_t res = 0;
+
+      X_LOCK (ck->lock);
+      start = ck->next;
+      /* chunks end at multiples of the chunk size, so they stay aligned */
+      end = (start / ck->chunk + 1) * ck->chunk;
+      if (end > ck->end)
+        end = ck->end;
+      ck->next = end > start ? end : start;
+      X_UNLOCK (ck->lock);
+
+      if (start >= end)
+        break;
+
+      for (pos = start; pos < end; pos += res)
+        {
+          char *buf = ck->buf + (pos - ck->offset);
+
+          res = ck->writing
+                ? pwrite (ck->fd, buf, end - pos, pos)
+                : pread  (ck->fd, buf, end - pos, pos);
+
+          if (res <= 0)
+            break;
+        }
+
+      /* the result is the part before the first short chunk */
+      if (pos < end)
+        {
+          int errorno = res < 0 ? errno : 0;
+
+          X_LOCK (ck->lock);
+          if (pos < ck->end)
+            {
+              ck->end = pos;
+              ck->errorno = errorno;
+            }
+          X_UNLOCK (ck->lock);
+        }
+    }
+}
+
+/* pread or pwrite, split into chunks transferred in parallel when large */
+static eio_ssize_t
+eio__prw (etp_worker *self, eio_req *req, int writing, int fd, void *buf, size_t size, off_t offset)
+{
+  struct eio_chunked ck;
+  size_t chunk = eio_io_chunk_size;
+
+  if (!chunk || size / 2 < chunk)
+    return writing
+           ? pwrite (fd, buf, size, offset)
+           : pread  (fd, buf, size, offset);
+
+  X_MUTEX_CREATE (ck.lock);
+  ck.next    = offset;
+  ck.end     = offset + size;
+  ck.errorno = 0;
+  ck.writing = writing;
+  ck.fd      = fd;
+  ck.buf     = (char *)buf;
+  ck.offset  = offset;
+  ck.chunk   = chunk;
+
+  etp_fanout_run (EIO_POOL, self, (size + chunk - 1) / chunk - 1, req->pri, eio__chunked_work, &ck);
+
+  X_MUTEX_DESTROY (ck.lock);
+
+  if (ck.end == offset && ck.errorno)
+    return EIO_ERRNO (ck.errorno, -1);
+
+  return ck.end - offset;
+}
+
+/* maximum number of queued adjacent writes merged into one, < 2 disables this */
+static unsigned int eio_max_write_coalesce;
+
+/* maximum span of reads merged into one, 0 disables this */
+static size_t eio_max_read_coalesce;
+
+/* merged reads go through the worker tmpbuf, which has an int size */
+#define EIO_MAX_READ_COALESCE (64 * 1024 * 1024)
+
+/* maximum number of queued requests looked at per dequeued read or write, as this holds reqlock */
+#define EIO_COALESCE_SCAN 256
+
+/* a merged read in progress, which queued reads within its range can join, locked by reqlock */
+struct eio_rdinfl
+{
+  struct eio_rdinfl *next;
+  long dev, ino;
+  off_t offs;
+  size_t size;
+  eio_req *waiters;
+  int closed; /* a write completed since, so later reads must not join */
+};
+
+static struct eio_rdinfl *eio_rdinfl_first;
+
+void ecb_cold
+eio_set_max_write_coalesce (unsigned int nreqs)
+{
+#ifdef IOV_MAX
+  if (nreqs > IOV_MAX)
+    nreqs = IOV_MAX;
+#endif
+
+  eio_max_write_coalesce = nreqs;
+}
+
+void ecb_cold
+eio_set_max_read_coalesce (size_t bytes)
+{
+  if (bytes > EIO_MAX_READ_COALESCE)
+    bytes = EIO_MAX_READ_COALESCE;
+
+  eio_max_read_coalesce = bytes;
+}
+
+#ifndef _WIN32
+
+/* stores the device and inode of the fd of a read in int2 and int3, called */
+/* when the read is submitted, as fstat must not be called with reqlock held */
+static void
+eio__fileid (eio_req *req)
+{
+  if (!(req->flags & EIO_FLAG_FILEID))
+    {
+      EIO_STRUCT_STAT st;
+      int errorno = errno;
+
+      req->flags |= EIO_FLAG_FILEID;
+      req->int2 = req->int3 = 0;
+
+      if (sizeof (long) >= sizeof (st.st_dev) && sizeof (long) >= sizeof (st.st_ino)
+          && !fstat (req->int1, &st))
+        {
+          req->int2 = st.st_dev;
+          req->int3 = st.st_ino;
+        }
+
+      errno = errorno;
+    }
+}
+
+/* returns zero if the file is unknown, because the read was submitted before */
+/* read coalescing was enabled, or device and inode do not fit */
+static int
+eio__hasfileid (eio_req *req)
+{
+  return req->flags & EIO_FLAG_FILEID && req->int3;
+}
+
+static int
+eio__samefile (eio_req *a, eio_req *b)
+{
+  return a->int1 == b->int1
+         || (eio__hasfileid (b) && a->int2 == b->int2 && a->int3 == b->int3);
+}
+
+/* takes queued writes to the same fd that continue where req ends */
+static void
+eio__coalesce_writes (etp_pool pool, eio_req *req)
+{
+  unsigned int max = eio_max_write_coalesce;
+  unsigned int n = 1;
+  unsigned int scan = EIO_COALESCE_SCAN;
+  eio_req *tail = req;
+  off_t end;
+  int found, later;
+
+  if (max < 2)
+    return;
+
+  end = req->offs + req->size;
+
+  /* requests usually are queued in file order, so another pass is only */
+  /* needed when a write further on was passed before the range grew */
+  do
+    {
+      int pri;
+
+      found = later = 0;
+
+      for (pri = ETP_NUM_PRI; pri--; )
+        {
+          eio_req *prev = 0, *next, *r;
+
+          for (r = pool->req_queue.qs[pri]; r && n < max && scan; r = next, --scan)
+            {
+              next = (eio_req *)r->next;
+
+              if (r->type == EIO_WRITE && r->int1 == req->int1 && r->offs == end && !EIO_CANCELLED (r))
+                {
+                  etp_reqq_take (pool, prev, r);
+
+                  r->next = 0;
+                  tail->next = r;
+                  tail = r;
+
+                  end += r->size;
+                  ++n;
+                  found = 1;
+                }
+              else
+                {
+                  if (r->type == EIO_WRITE && r->int1 == req->int1 && r->offs > end)
+                    later = 1;
+
+                  prev = r;
+                }
+            }
+        }
+    }
+  while (found && later && n < max && scan);
+
+  if (tail != req)
+    req->flags |= EIO_FLAG_COALESCED;
+}
+
+/* joins a merged read in progress that covers req, or takes queued reads of the */
+/* same file that overlap or touch req and registers them as a read in progress */
+static int
+eio__coalesce_reads (etp_pool pool, eio_req *req)
+{
+  size_t max = eio_max_read_coalesce;
+  unsigned int scan = EIO_COALESCE_SCAN;
+  struct eio_rdinfl *inf;
+  eio_req *tail = req;
+  off_t start, end;
+  int grown, other;
+
+  if (!max || !eio__hasfileid (req))
+    return 0;
+
+  for (inf = eio_rdinfl_first; inf; inf = inf->next)
+    if (!inf->closed && inf->dev == req->int2 && inf->ino == req->int3
+        && inf->offs <= req->offs && req->offs + (off_t)req->size <= inf->offs + (off_t)inf->size)
+      {
+        req->next = inf->waiters;
+        inf->waiters = req;
+        return 1;
+      }
+
+  inf = (struct eio_rdinfl *)malloc (sizeof *inf);
+  if (!inf)
+    return 0;
+
+  start = req->offs;
+  end   = req->offs + req->size;
+
+  /* another pass is only needed when a read of the same file was passed */
+  /* before the range grew, as it might overlap now */
+  do
+    {
+      int pri;
+
+      grown = other = 0;
+
+      for (pri = ETP_NUM_PRI; pri--; )
+        {
+          eio_req *prev = 0, *next, *r;
+
+          for (r = pool->req_queue.qs[pri]; r && scan; r = next, --scan)
+            {
+              off_t rend = r->offs + r->size;
+
+              next = (eio_req *)r->next;
+
+              if (r->type == EIO_READ && r->offs >= 0 && r->offs <= end && rend >= start
+                  && (rend > end ? rend : end) - (r->offs < start ? r->offs : start) <= max
+                  && !EIO_CANCELLED (r) && eio__samefile (req, r))
+                {
+                  etp_reqq_take (pool, prev, r);
+
+                  r->next = 0;
+                  tail->next = r;
+                  tail = r;
+
+                  if (r->offs < start) start = r->offs, grown = 1;
+                  if (rend     > end  ) end   = rend    , grown = 1;
+                }
+              else
+                {
+                  if (r->type == EIO_READ && r->offs >= 0 && !EIO_CANCELLED (r) && eio__samefile (req, r))
+                    other = 1;
+
+                  prev = r;
+                }
+            }
+        }
+    }
+  while (grown && other && scan);
+
+  inf->dev     = req->int2;
+  inf->ino     = req->int3;
+  inf->offs    = start;
+  inf->size    = end - start;
+  inf->waiters = 0;
+  inf->closed  = 0;
+  inf->next    = eio_rdinfl_first;
+  eio_rdinfl_first = inf;
+
+  req->ptr1   = inf;
+  req->flags |= EIO_FLAG_COALESCED;
+
+  return 0;
+}
+
+#endif
+
+/* called with reqlock held for every dequeued request */
+static int
+eio_coalesce (etp_pool pool, eio_req *req)
+{
+#ifndef _WIN32
+  if (req->offs < 0 || EIO_CANCELLED (req))
+    return 0;
+
+  if (req->type == EIO_WRITE)
+    eio__coalesce_writes (pool, req);
+  else if (req->type == EIO_READ)
+    return eio__coalesce_reads (pool, req);
+#endif
+
+  return 0;
+}
+
+#ifndef _WIN32
+/* a read in progress might have read the data before a write that just */
+/* completed, and a read submitted after that write must not see old data */
+static void
+eio__rdinfl_close (void)
+{
+  struct eio_rdinfl *inf;
+
+  X_LOCK (EIO_POOL->reqlock);
+
+  for (inf = eio_rdinfl_first; inf; inf = inf->next)
+    inf->closed = 1;
+
+  X_UNLOCK (EIO_POOL->reqlock);
+}
+
+/* see "drop-behind for streaming fds" below */
+static int eio_dropbehind_count;
+static void eio__drop_behind (etp_worker *self, eio_req *req);
+
+/* writes req and the requests coalesced with it with a single pwritev, */
+/* then finishes the requests it could not write fully one by one */
+static void
+eio__write_coalesced (etp_worker *self, eio_req *req)
+{
+  struct iovec *iov;
+  eio_ssize_t res;
+  eio_req *r;
+  int n = 0;
+
+  for (r = req; r; r = (eio_req *)r->next)
+    ++n;
+
+  iov = (struct iovec *)etp_tmpbuf_get (&self->tmpbuf, n * sizeof *iov);
+
+  /* without memory for the iovecs, every request is written on its own below */
+  res = 0;
+
+  if (iov)
+    {
+      for (n = 0, r = req; r; r = (eio_req *)r->next, ++n)
+        {
+          iov [n].iov_base = r->ptr2;
+          iov [n].iov_len  = r->size;
+        }
+
+      res = eio__rwv (1, req->int1, iov, n, req->offs, 0);
+
+      if (res < 0)
+        res = 0;
+    }
+
+  for (r = req; r; r = (eio_req *)r->next)
+    {
+      size_t done = (size_t)res < r->size ? (size_t)res : r->size;
+
+      res -= done;
+      r->result = done;
+
+      if (done < r->size)
+        {
+          eio_ssize_t more = pwrite (r->int1, (char *)r->ptr2 + done, r->size - done, r->offs + done);
+
+          if (more > 0)
+            r->result += more;
+          else if (!done)
+            r->result = more;
+        }
+
+      r->errorno = errno;
+
+      /* like after the switch in eio_execute */
+      if (eio_dropbehind_count && r->result > 0)
+        eio__drop_behind (self, r);
+    }
+
+  if (eio_max_read_coalesce)
+    eio__rdinfl_close ();
+
+  errno = req->errorno;
+}
+
+/* like ALLOC, for requests executed along with another one */
+static int
+eio__alloc (eio_req *req)
+{
+  if (!req->ptr2)
+    {
+      X_LOCK (EIO_POOL->wrklock);
+      req->flags |= EIO_FLAG_PTR2_FREE;
+      X_UNLOCK (EIO_POOL->wrklock);
+      req->ptr2 = malloc (req->size);
+    }
+
+  return !!req->ptr2;
+}
+
+/* see "readahead for sequential reads" below */
+static size_t eio_max_readahead_window;
+static int eio__ratrack (etp_worker *self, eio_req *req);
+
+/* reads the range of the read in progress registered for req once, then hands */
+/* out the data to all requests merged with it or that joined it meanwhile */
+static void
+eio__read_coalesced (etp_worker *self, eio_req *req)
+{
+  struct eio_rdinfl *inf = (struct eio_rdinfl *)req->ptr1, **infp;
+  off_t start = inf->offs;
+  size_t size = inf->size;
+  eio_req *r, *waiters;
+  eio_ssize_t res;
+  int errorno;
+  char *buf;
+
+  req->ptr1 = 0;
+
+  /* read directly into the buffer of req when nothing was merged */
+  if (start == req->offs && size == req->size && eio__alloc (req))
+    {
+      buf = (char *)req->ptr2;
+      res = eio__prw (self, req, 0, req->int1, buf, size, start);
+    }
+  else
+    {
+      /* without a buffer, every request is read on its own below */
+      buf = size <= EIO_MAX_READ_COALESCE ? (char *)etp_tmpbuf_get (&self->tmpbuf, size) : 0;
+      res = buf ? pread (req->int1, buf, size, start) : EIO_ERRNO (ENOMEM, -1);
+    }
+
+  errorno = errno;
+
+  X_LOCK (EIO_POOL->reqlock);
+  for (infp = &eio_rdinfl_first; *infp != inf; infp = &(*infp)->next)
+    ;
+  *infp = inf->next;
+  waiters = inf->waiters;
+  X_UNLOCK (EIO_POOL->reqlock);
+
+  free (inf);
+
+  for (r = req; r->next; r = (eio_req *)r->next)
+    ;
+  r->next = waiters;
+
+  for (r = req; r; r = (eio_req *)r->next)
+    {
+      if (r == req && buf && buf == r->ptr2)
+        {
+          r->result  = res;
+          r->errorno = errorno;
+        }
+      else if (!eio__alloc (r))
+        {
+          r->result  = -1;
+          r->errorno = ENOMEM;
+        }
+      else if (res < 0)
+        {
+          /* the data might still be readable through another fd */
+          r->result  = pread (r->int1, r->ptr2, r->size, r->offs);
+          r->errorno = errno;
+        }
+      else
+        {
+          off_t avail = start + res - r->offs;
+
+          if (avail < 0)
+            avail = 0;
+          else if (avail > (off_t)r->size)
+            avail = r->size;
+
+          memcpy (r->ptr2, buf + (r->offs - start), avail);
+          r->result  = avail;
+          r->errorno = 0;
+        }
+
+      /* like the EIO_READ case in eio_execute, and after its switch */
+      if (eio_max_readahead_window && r->result > 0)
+        eio__ratrack (self, r);
+
+      if (eio_dropbehind_count && r->result > 0)
+        eio__drop_behind (self, r);
+    }
+
+  errno = req->errorno;
+}
+#endif
+
+static void
+eio__slurp (int fd, eio_req *req, etp_worker *self)
+{
+  req->result = fd;
 
-  symlinks = GetFullPathName (rel, EIO_PATH_MAX * 3, res, 0);
+  if (fd < 0)
+    return;
 
-  errno = ENAMETOOLONG;
-  if (symlinks >= EIO_PATH_MAX * 3)
-    return -1;
+  if (req->offs < 0 || !req->size) /* do we need the size? */
+    {
+      off_t size = lseek (fd, 0, SEEK_END);
 
-  errno = EIO;
-  if (symlinks <= 0)
-    return -1;
+      if (req->offs < 0)
+        req->offs += size;
 
-  return symlinks;
+      if (!req->size)
+        req->size = size - req->offs;
+    }
 
-#else
-  tmp1 = res  + EIO_PATH_MAX;
-  tmp2 = tmp1 + EIO_PATH_MAX;
+#if _POSIX_MAPPED_FILES
+  if (req->int1 & EIO_SLURP_MMAP && !req->ptr2)
+    {
+      EIO_STRUCT_STAT st;
 
-#if 0 /* disabled, the musl way to do things is just too racy */
-#if __linux && defined(O_NONBLOCK) && defined(O_NOATIME)
-  /* on linux we may be able to ask the kernel */
-  {
-    int fd = open (rel, O_RDONLY | O_NONBLOCK | O_NOCTTY | O_NOATIME);
+      /* only map what exists, so the mapping is usable like a read buffer */
+      if (!fstat (fd, &st) && S_ISREG (st.st_mode) && req->offs < st.st_size)
+        {
+          intptr_t pad = req->offs & (eio_pagesize () - 1);
+          int mflags = MAP_SHARED;
+          void *addr;
 
-    if (fd >= 0)
-      {
-        sprintf (tmp1, "/proc/self/fd/%d", fd);
-        req->result = readlink (tmp1, res, EIO_PATH_MAX);
-        /* here we should probably stat the open file and the disk file, to make sure they still match */
-        eio__close (fd);
+          if (req->size > st.st_size - req->offs)
+            req->size = st.st_size - req->offs;
 
-        if (req->result > 0)
-          goto done;
-      }
-    else if (errno == ELOOP || errno == ENAMETOOLONG || errno == ENOENT || errno == ENOTDIR || errno == EIO)
-      return -1;
-  }
-#endif
+          #ifdef MAP_POPULATE
+          if (req->int1 & EIO_SLURP_POPULATE)
+            mflags |= MAP_POPULATE;
+          #endif
+
+          addr = mmap (0, req->size + pad, PROT_READ, mflags, fd, req->offs - pad);
+
+          if (addr != MAP_FAILED)
+            {
+              #ifdef MADV_SEQUENTIAL
+              if (req->int1 & EIO_SLURP_SEQUENTIAL)
+                madvise (addr, req->size + pad, MADV_SEQUENTIAL);
+              #endif
+              #ifdef MADV_WILLNEED
+              if (req->int1 & EIO_SLURP_WILLNEED)
+                madvise (addr, req->size + pad, MADV_WILLNEED);
+              #endif
+
+              X_LOCK (EIO_POOL->wrklock);
+              req->flags |= EIO_FLAG_MUNMAP;
+              X_UNLOCK (EIO_POOL->wrklock);
+              req->int2   = pad;
+              req->ptr2   = (char *)addr + pad;
+              req->result = req->size;
+
+              silent_close (fd);
+              return;
+            }
+        }
+    }
 #endif
 
-  if (*rel != '/')
+  /* fall back to reading the file */
+  ALLOC (req->size);
+  req->result = eio__prw (self, req, 0, fd, req->ptr2, req->size, req->offs);
+
+  silent_close (fd);
+
+alloc_fail:
+  ;
+}
+
+int ecb_cold
+eio_init (void (*want_poll)(void), void (*done_poll)(void))
+{
+  eio_want_poll_cb = want_poll;
+  eio_done_poll_cb = done_poll;
+
+  return etp_init (EIO_POOL, 0, 0, 0);
+}
+
+ecb_inline void
+eio_api_destroy (eio_req *req)
+{
+  free (req);
+}
+
+/*****************************************************************************/
+/* readahead for sequential reads */
+
+#define EIO_RATRACK_SLOTS 64  /* fds tracked, direct-mapped */
+#define EIO_RATRACK_MIN   (128 * 1024) /* minimum readahead window */
+
+struct eio_ratrack
+{
+  int fd;
+  off_t next;     /* where a sequential read would continue */
+  off_t ahead;    /* end of the readahead issued so far */
+  size_t window;  /* size of the next readahead, 0 if the slot is unused */
+};
+
+static size_t eio_max_readahead_window;
+static xmutex_t eio_ratrack_lock = X_MUTEX_INIT;
+static struct eio_ratrack eio_ratrack [EIO_RATRACK_SLOTS];
+
+void ecb_cold
+eio_set_max_readahead_window (size_t bytes)
+{
+  eio_max_readahead_window = bytes;
+}
+
+/* called after a successful positional read, when the reader comes within */
+/* half a window of the readahead issued so far, issues the next, larger, window */
+/* right away, as the fd might be closed or reused once the callback has run. */
+/* without a worker (self == 0), returns 0 instead of issuing one */
+static int
+eio__ratrack (etp_worker *self, eio_req *req)
+{
+  struct eio_ratrack *rt = eio_ratrack + (unsigned int)req->int1 % EIO_RATRACK_SLOTS;
+  size_t max = eio_max_readahead_window;
+  off_t end = req->offs + req->result;
+  off_t ra_offs = 0;
+  size_t ra_len = 0;
+
+  X_LOCK (eio_ratrack_lock);
+
+  if (rt->window && rt->fd == req->int1 && rt->next == req->offs)
     {
-      int len;
+      off_t ahead = rt->ahead < end ? end : rt->ahead;
 
-      errno = ENOENT;
-      if (wd == EIO_INVALID_WD)
-        return -1;
-      
-      if (wd == EIO_CWD)
+      if (end + (off_t)(rt->window / 2) >= ahead)
         {
-          if (!getcwd (res, EIO_PATH_MAX))
-            return -1;
+          if (!self)
+            {
+              X_UNLOCK (eio_ratrack_lock);
+              return 0;
+            }
 
-          len = strlen (res);
+          ra_offs = ahead;
+          ra_len  = rt->window;
+
+          ahead += rt->window;
+          rt->window = rt->window * 2 < max ? rt->window * 2 : max;
         }
-      else
-        memcpy (res, wd->str, len = wd->len);
 
-      if (res [1]) /* only use if not / */
-        res += len;
+      rt->ahead = ahead;
     }
+  else
+    {
+      /* start over, like the kernel does, with a window of a few reads */
+      rt->fd     = req->int1;
+      rt->ahead  = end;
+      rt->window = req->size * 4 > EIO_RATRACK_MIN ? req->size * 4 : EIO_RATRACK_MIN;
 
-  while (*rel)
+      if (rt->window > max)
+        rt->window = max;
+    }
+
+  rt->next = end;
+
+  X_UNLOCK (eio_ratrack_lock);
+
+  /* willneed only starts the readahead */
+  if (ra_len)
     {
-      eio_ssize_t len, linklen;
-      const char *beg = rel;
+      int errorno = errno;
+      eio__fadvise (req->int1, ra_offs, ra_len, EIO_FADV_WILLNEED, self);
+      errno = errorno;
+    }
 
-      while (*rel && *rel != '/')
-        ++rel;
+  return 1;
+}
 
-      len = rel - beg;
+/*****************************************************************************/
+/* drop-behind for streaming fds */
 
-      if (!len) /* skip slashes */
+#define EIO_DROP_BEHIND_CHUNK (1024 * 1024) /* writeback granularity */
+/* large folios can only be dropped as a whole, so also drop this much before a range */
+#define EIO_DROP_BEHIND_LOOKBACK (4 * 1024 * 1024)
+
+struct eio_dropbehind
+{
+  unsigned char on;
+  off_t run, next;    /* start and end of the current sequential run */
+  off_t wstart, wend; /* written range whose writeback has not been started yet */
+  off_t pstart, pend; /* written range under writeback */
+};
+
+static xmutex_t eio_dropbehind_lock = X_MUTEX_INIT;
+static struct eio_dropbehind *eio_dropbehind; /* indexed by fd */
+static int eio_dropbehind_max; /* size of eio_dropbehind */
+static int eio_dropbehind_count; /* number of fds in drop-behind mode */
+
+int
+eio_set_drop_behind (int fd, int enable)
+{
+  int res = 0;
+
+  if (fd < 0)
+    return EIO_ERRNO (EBADF, -1);
+
+  X_LOCK (eio_dropbehind_lock);
+
+  if (enable && fd >= eio_dropbehind_max)
+    {
+      int max = fd < 60 ? 64 : fd * 2;
+      struct eio_dropbehind *db = (struct eio_dropbehind *)realloc (eio_dropbehind, max * sizeof *db);
+
+      if (db)
         {
-          ++rel;
-          continue;
+          memset (db + eio_dropbehind_max, 0, (max - eio_dropbehind_max) * sizeof *db);
+          eio_dropbehind     = db;
+          eio_dropbehind_max = max;
         }
+      else
+        res = EIO_ERRNO (ENOMEM, -1);
+    }
 
-      if (beg [0] == '.')
+  if (!res && fd < eio_dropbehind_max && !eio_dropbehind [fd].on != !enable)
+    {
+      memset (eio_dropbehind + fd, 0, sizeof *eio_dropbehind);
+      eio_dropbehind [fd].on = !!enable;
+      eio_dropbehind_count += enable ? 1 : -1;
+    }
+
+  X_UNLOCK (eio_dropbehind_lock);
+
+  return res;
+}
+
+/* drops the pages of what a request on an fd in drop-behind mode has read */
+/* from the page cache, or starts writeback of what it wrote, and drops what */
+/* an earlier request wrote once that has been written back */
+static void
+eio__drop_behind (etp_worker *self, eio_req *req)
+{
+  int fd = req->type == EIO_SENDFILE ? req->int2 : req->int1;
+  int writing = req->type == EIO_WRITE || req->type == EIO_WRITEV;
+  off_t start = req->offs, end;
+  off_t wstart = 0, wend = 0, pstart = 0, pend = 0, run = 0;
+  int errorno = errno;
+
+  if (start < 0)
+    start = lseek (fd, 0, SEEK_CUR) - req->result;
+
+  if (start < 0)
+    goto done;
+
+  end = start + req->result;
+
+  X_LOCK (eio_dropbehind_lock);
+
+  if (fd < eio_dropbehind_max && eio_dropbehind [fd].on)
+    {
+      struct eio_dropbehind *db = eio_dropbehind + fd;
+
+      if (db->next != start)
+        db->run = start;
+
+      db->next = end;
+
+      if (!writing)
         {
-          if (len == 1)
-            continue; /* . - nop */
+          wstart = start;
+          wend   = end;
+        }
+      else
+        {
+          if (db->wend != start)
+            db->wstart = db->wend = start;
 
-          if (beg [1] == '.' && len == 2)
-            {
-              /* .. - back up one component, if possible */
+          db->wend = end;
 
-              while (res != tmpbuf->ptr)
-                if (*--res == '/')
-                  break;
+          /* hand out full chunks, the range written before to be dropped, */
+          /* and the range written now to start its writeback */
+          if (db->wend - db->wstart >= EIO_DROP_BEHIND_CHUNK)
+            {
+              pstart = db->pstart; pend = db->pend;
+              wstart = db->wstart; wend = db->wend;
 
-              continue;
+              db->pstart = db->wstart; db->pend = db->wend;
+              db->wstart = db->wend;
             }
         }
 
-        errno = ENAMETOOLONG;
-        if (res + 1 + len + 1 >= tmp1)
-          return -1;
+      run = db->run;
+    }
 
-        /* copy one component */
-        *res = '/';
-        memcpy (res + 1, beg, len);
+  X_UNLOCK (eio_dropbehind_lock);
 
-        /* zero-terminate, for readlink */
-        res [len + 1] = 0;
+#if HAVE_SYNC_FILE_RANGE
+  if (wend > wstart && writing)
+    sync_file_range (fd, wstart, wend - wstart, SYNC_FILE_RANGE_WRITE);
 
-        /* now check if it's a symlink */
-        linklen = readlink (tmpbuf->ptr, tmp1, EIO_PATH_MAX);
+  if (pend > pstart)
+    sync_file_range (fd, pstart, pend - pstart,
+                     SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+#endif
 
-        if (linklen < 0)
-          {
-            if (errno != EINVAL)
-              return -1;
+  if (!writing)
+    {
+      pstart = wstart;
+      pend   = wend;
+    }
 
-            /* it's a normal directory. hopefully */
-            res += len + 1;
-          }
-        else
-          {
-            /* yay, it was a symlink - build new path in tmp2 */
-            int rellen = strlen (rel);
+  if (pend > pstart)
+    {
+      /* also drop what was left behind because it shared a page or folio with */
+      /* unread or unwritten data, but only for data this run went through */
+      off_t from = pstart - EIO_DROP_BEHIND_LOOKBACK;
 
-            errno = ENAMETOOLONG;
-            if (linklen + 1 + rellen >= EIO_PATH_MAX) /* also catch linklen >= EIO_PATH_MAX */
-              return -1;
+      if (from < run)
+        from = run;
 
-            errno = ELOOP;
-            if (!--symlinks)
-              return -1;
+      if (from < pstart)
+        pstart = from & ~(off_t)(eio_pagesize () - 1);
 
-            if (*tmp1 == '/')
-              res = tmpbuf->ptr; /* symlink resolves to an absolute path */
+      eio__fadvise (fd, pstart, pend - pstart, EIO_FADV_DONTNEED, self);
+    }
+
+done:
+  errno = errorno;
+}
+
+/*****************************************************************************/
+/* attribute cache for stat and lstat */
+
+#define EIO_STATCACHE_WATCH_SLOTS 64 /* hash buckets for directory watches */
+
+#if HAVE_INOTIFY
+/* everything that can change the result of a stat on a directory entry, except atime */
+#define EIO_STATCACHE_EVENTS (IN_ATTRIB | IN_MODIFY | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO \
+                              | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR)
+#endif
+
+struct eio_statent;
+
+struct eio_statwatch
+{
+  struct eio_statwatch *next; /* hash chain */
+  struct eio_statent *ents;   /* entries for paths in this directory */
+  int wd;                     /* inotify watch descriptor */
+  unsigned int gen;           /* incremented by every event for this directory */
+  unsigned int refcnt;        /* entries, plus stats in progress */
+  unsigned char dead;         /* the kernel removed the watch */
+};
+
+struct eio_statent
+{
+  struct eio_statent *hnext;         /* hash chain */
+  struct eio_statent *prev, *next;   /* lru list, most recently used first */
+  struct eio_statent *wprev, *wnext; /* entries of the same watch */
+  struct eio_statwatch *watch;       /* parent directory watch, or 0 */
+  eio_wd wd;
+  unsigned int hash;
+  unsigned char type;
+  int result, errorno;
+  eio_tstamp expires;                /* 0 if only the watch invalidates the entry */
+  EIO_STRUCT_STAT st;
+  char path [1];                     /* actually, longer */
+};
+
+static xmutex_t eio_statcache_lock = X_MUTEX_INIT;
+static unsigned int eio_statcache_max; /* maximum number of entries, 0 if disabled */
+static unsigned int eio_statcache_count;
+static eio_tstamp eio_statcache_ttl;
+static struct eio_statent **eio_statcache_hash;
+static unsigned int eio_statcache_mask; /* number of hash buckets - 1 */
+static struct eio_statent *eio_statcache_first, *eio_statcache_last; /* lru list */
+static struct eio_statwatch *eio_statcache_watches [EIO_STATCACHE_WATCH_SLOTS];
+static int eio_statcache_fd = -1; /* inotify fd, -1 if there is none */
+
+static unsigned int
+eio__statcache_hashof (eio_wd wd, int type, const char *path)
+{
+  return eio__strhash ((unsigned int)(unsigned long)wd ^ type, path);
+}
+
+static struct eio_statwatch *
+eio__statcache_find_watch (int wd)
+{
+  struct eio_statwatch *w = eio_statcache_watches [(unsigned int)wd % EIO_STATCACHE_WATCH_SLOTS];
+
+  while (w && w->wd != wd)
+    w = w->next;
+
+  return w;
+}
+
+/* drops a reference to w, removing the watch with the last one */
+static void
+eio__statcache_unwatch (struct eio_statwatch *w)
+{
+  struct eio_statwatch **p;
+
+  if (--w->refcnt)
+    return;
+
+  for (p = eio_statcache_watches + (unsigned int)w->wd % EIO_STATCACHE_WATCH_SLOTS; *p != w; p = &(*p)->next)
+    ;
+
+  *p = w->next;
+
+#if HAVE_INOTIFY
+  if (!w->dead)
+    inotify_rm_watch (eio_statcache_fd, w->wd);
+#endif
+
+  free (w);
+}
+
+static void
+eio__statcache_unlink (struct eio_statent *e)
+{
+  struct eio_statent **p;
+
+  for (p = eio_statcache_hash + (e->hash & eio_statcache_mask); *p != e; p = &(*p)->hnext)
+    ;
+
+  *p = e->hnext;
+
+  if (e->prev) e->prev->next = e->next; else eio_statcache_first = e->next;
+  if (e->next) e->next->prev = e->prev; else eio_statcache_last  = e->prev;
+
+  if (e->watch)
+    {
+      if (e->wprev) e->wprev->wnext = e->wnext; else e->watch->ents = e->wnext;
+      if (e->wnext) e->wnext->wprev = e->wprev;
+
+      eio__statcache_unwatch (e->watch);
+    }
+
+  --eio_statcache_count;
+  free (e);
+}
+
+/* removes the entries for wd, or all of them if wd is EIO_INVALID_WD */
+static void
+eio__statcache_flush (eio_wd wd)
+{
+  struct eio_statent *e, *next;
+
+  for (e = eio_statcache_first; e; e = next)
+    {
+      next = e->next;
+
+      if (wd == EIO_INVALID_WD || e->wd == wd)
+        eio__statcache_unlink (e);
+    }
+}
+
+/* removes the entries for paths in the directory of w called name, or all of them if name is 0 */
+static void
+eio__statcache_flush_watch (struct eio_statwatch *w, const char *name)
+{
+  struct eio_statent *e, *next;
+
+  ++w->refcnt; /* the last entry must not free w */
 
-            /* we need to be careful, as rel might point into tmp2 already */
-            memmove (tmp2 + linklen + 1, rel, rellen + 1);
-            tmp2 [linklen] = '/';
-            memcpy (tmp2, tmp1, linklen);
+  for (e = w->ents; e; e = next)
+    {
+      const char *base = strrchr (e->path, '/');
 
-            rel = tmp2;
-          }
-    }
+      next = e->wnext;
 
-  /* special case for the lone root path */
-  if (res == tmpbuf->ptr)
-    *res++ = '/';
+      if (!name || !strcmp (base ? base + 1 : e->path, name))
+        eio__statcache_unlink (e);
+    }
 
-  return res - (char *)tmpbuf->ptr;
-#endif
+  eio__statcache_unwatch (w);
 }
 
-static signed char
-eio_dent_cmp (const eio_dirent *a, const eio_dirent *b)
+/* called by eio_wd_close_sync, as the address of wd might be reused */
+static void
+eio__statcache_forget (eio_wd wd)
 {
-  return a->score - b->score ? a->score - b->score /* works because our signed char is always 0..100 */
-       : a->inode < b->inode ? -1
-       : a->inode > b->inode ?  1
-       :                        0;
+  X_LOCK (eio_statcache_lock);
+  eio__statcache_flush (wd);
+  X_UNLOCK (eio_statcache_lock);
 }
 
-#define EIO_DENT_CMP(i,op,j) eio_dent_cmp (&i, &j) op 0
-
-#define EIO_SORT_CUTOFF 30 /* quite high, but performs well on many filesystems */
-#define EIO_SORT_FAST   60 /* when to only use insertion sort */
+#if HAVE_INOTIFY
 
 static void
-eio_dent_radix_sort (eio_dirent *dents, int size, signed char score_bits, eio_ino_t inode_bits)
+eio__statcache_event (struct inotify_event *ev)
 {
-  unsigned char bits [9 + sizeof (eio_ino_t) * 8];
-  unsigned char *bit = bits;
-
-  assert (CHAR_BIT == 8);
-  assert (sizeof (eio_dirent) * 8 < 256);
-  assert (offsetof (eio_dirent, inode)); /* we use bit #0 as sentinel */
-  assert (offsetof (eio_dirent, score)); /* we use bit #0 as sentinel */
+  struct eio_statwatch *w;
 
-  if (size <= EIO_SORT_FAST)
-    return;
+  if (ev->mask & IN_Q_OVERFLOW)
+    {
+      int i;
 
-  /* first prepare an array of bits to test in our radix sort */
-  /* try to take endianness into account, as well as differences in eio_ino_t sizes */
-  /* inode_bits must contain all inodes ORed together */
-  /* which is used to skip bits that are 0 everywhere, which is very common */
-  {
-    eio_ino_t endianness;
-    int i, j;
+      /* events were lost, so nothing can be trusted anymore */
+      eio__statcache_flush (EIO_INVALID_WD);
 
-    /* we store the byte offset of byte n into byte n of "endianness" */
-    for (i = 0; i < sizeof (eio_ino_t); ++i)
-      ((unsigned char *)&endianness)[i] = i;
+      for (i = 0; i < EIO_STATCACHE_WATCH_SLOTS; ++i)
+        for (w = eio_statcache_watches [i]; w; w = w->next)
+          ++w->gen;
 
-    *bit++ = 0;
+      return;
+    }
 
-    for (i = 0; i < sizeof (eio_ino_t); ++i)
-      {
-        /* shifting off the byte offsets out of "endianness" */
-        int offs = (offsetof (eio_dirent, inode) + (endianness & 0xff)) * 8;
-        endianness >>= 8;
+  w = eio__statcache_find_watch (ev->wd);
 
-        for (j = 0; j < 8; ++j)
-          if (inode_bits & (((eio_ino_t)1) << (i * 8 + j)))
-            *bit++ = offs + j;
-      }
+  if (!w)
+    return;
 
-    for (j = 0; j < 8; ++j)
-      if (score_bits & (1 << j))
-        *bit++ = offsetof (eio_dirent, score) * 8 + j;
-  }
+  ++w->gen;
 
-  /* now actually do the sorting (a variant of MSD radix sort) */
-  {
-    eio_dirent    *base_stk [9 + sizeof (eio_ino_t) * 8], *base;
-    eio_dirent    *end_stk  [9 + sizeof (eio_ino_t) * 8], *end;
-    unsigned char *bit_stk  [9 + sizeof (eio_ino_t) * 8];
-    int stk_idx = 0;
+  if (ev->mask & IN_IGNORED)
+    w->dead = 1;
 
-    base_stk [stk_idx] = dents;
-    end_stk  [stk_idx] = dents + size;
-    bit_stk  [stk_idx] = bit - 1;
+  /* events without a name are about the directory itself, which affects all entries */
+  eio__statcache_flush_watch (w, ev->len ? ev->name : 0);
+}
 
-    do
-      {
-        base = base_stk [stk_idx];
-        end  = end_stk  [stk_idx];
-        bit  = bit_stk  [stk_idx];
+X_THREAD_PROC (eio_statcache_proc)
+{
+  char buf [4096] ecb_attribute ((aligned (__alignof__ (struct inotify_event))));
 
-        for (;;)
-          {
-            unsigned char O = *bit >> 3;
-            unsigned char M = 1 << (*bit & 7);
+  for (;;)
+    {
+      char *ev;
+      ssize_t len = read (eio_statcache_fd, buf, sizeof buf);
 
-            eio_dirent *a = base;
-            eio_dirent *b = end;
+      if (len <= 0)
+        {
+          if (len < 0 && errno == EINTR)
+            continue;
 
-            if (b - a < EIO_SORT_CUTOFF)
-              break;
+          break;
+        }
 
-            /* now bit-partition the array on the bit */
-            /* this ugly asymmetric loop seems to perform much better than typical */
-            /* partition algos found in the literature */
-            do
-              if (!(((unsigned char *)a)[O] & M))
-                ++a;
-              else if (!(((unsigned char *)--b)[O] & M))
-                {
-                  eio_dirent tmp = *a; *a = *b; *b = tmp;
-                  ++a;
-                }
-            while (b > a);
+      X_LOCK (eio_statcache_lock);
 
-            /* next bit, or stop, if no bits left in this path */
-            if (!*--bit)
-              break;
+      for (ev = buf; ev < buf + len; ev += sizeof (struct inotify_event) + ((struct inotify_event *)ev)->len)
+        eio__statcache_event ((struct inotify_event *)ev);
 
-            base_stk [stk_idx] = a;
-            end_stk  [stk_idx] = end;
-            bit_stk  [stk_idx] = bit;
-            ++stk_idx;
+      X_UNLOCK (eio_statcache_lock);
+    }
 
-            end = a;
-          }
-      }
-    while (stk_idx--);
-  }
+  return 0;
 }
 
-static void
-eio_dent_insertion_sort (eio_dirent *dents, int size)
+#endif
+
+void ecb_cold
+eio_set_stat_cache (unsigned int entries, eio_tstamp ttl)
 {
-  /* first move the smallest element to the front, to act as a sentinel */
-  {
-    int i;
-    eio_dirent *min = dents;
-    
-    /* the radix pre-pass ensures that the minimum element is in the first EIO_SORT_CUTOFF + 1 elements */
-    for (i = size > EIO_SORT_FAST ? EIO_SORT_CUTOFF + 1 : size; --i; )
-      if (EIO_DENT_CMP (dents [i], <, *min))
-        min = &dents [i];
+  X_LOCK (eio_statcache_lock);
 
-    /* swap elements 0 and j (minimum) */
+  if (eio_statcache_hash)
+    eio__statcache_flush (EIO_INVALID_WD);
+
+  free (eio_statcache_hash);
+  eio_statcache_hash = 0;
+  eio_statcache_max  = 0;
+
+  if (entries)
     {
-      eio_dirent tmp = *dents; *dents = *min; *min = tmp;
-    }
-  }
+      unsigned int size = 16;
 
-  /* then do standard insertion sort, assuming that all elements are >= dents [0] */
-  {
-    eio_dirent *i, *j;
+      while (size < entries && size < 0x40000000U)
+        size <<= 1;
 
-    for (i = dents + 1; i < dents + size; ++i)
-      {
-        eio_dirent value = *i;
+      eio_statcache_hash = (struct eio_statent **)calloc (size, sizeof (struct eio_statent *));
 
-        for (j = i - 1; EIO_DENT_CMP (*j, >, value); --j)
-          j [1] = j [0];
+      if (eio_statcache_hash)
+        {
+          eio_statcache_mask = size - 1;
+          eio_statcache_max  = entries;
+          eio_statcache_ttl  = ttl;
+        }
 
-        j [1] = value;
-      }
-  }
-}
+      #if HAVE_INOTIFY
+      if (eio_statcache_fd < 0)
+        {
+          xthread_t tid;
 
-static void
-eio_dent_sort (eio_dirent *dents, int size, signed char score_bits, eio_ino_t inode_bits)
-{
-  if (size <= 1)
-    return; /* our insertion sort relies on size > 0 */
+          eio_statcache_fd = inotify_init1 (IN_CLOEXEC);
 
-  /* first we use a radix sort, but only for dirs >= EIO_SORT_FAST */
-  /* and stop sorting when the partitions are <= EIO_SORT_CUTOFF */
-  eio_dent_radix_sort (dents, size, score_bits, inode_bits);
+          /* without inotify, only the ttl expires entries */
+          if (eio_statcache_fd >= 0 && !xthread_create (&tid, eio_statcache_proc, 0))
+            {
+              close (eio_statcache_fd);
+              eio_statcache_fd = -1;
+            }
+        }
+      #endif
+    }
 
-  /* use an insertion sort at the end, or for small arrays, */
-  /* as insertion sort is more efficient for small partitions */
-  eio_dent_insertion_sort (dents, size);
+  X_UNLOCK (eio_statcache_lock);
 }
 
-/* read a full directory */
-static void
-eio__scandir (eio_req *req, etp_worker *self)
+/* completes req from the cache, returns non-zero on a hit */
+static int
+eio__statcache_get (eio_req *req)
 {
-  char *name, *names;
-  int namesalloc = 4096 - sizeof (void *) * 4;
-  int namesoffs = 0;
-  int flags = req->int1;
-  eio_dirent *dents = 0;
-  int dentalloc = 128;
-  int dentoffs = 0;
-  eio_ino_t inode_bits = 0;
-#ifdef _WIN32
-  HANDLE dirp;
-  WIN32_FIND_DATA entp;
-#else
-  DIR *dirp;
-  EIO_STRUCT_DIRENT *entp;
-#endif
+  unsigned int hash = eio__statcache_hashof (req->wd, req->type, req->ptr1);
+  struct eio_statent *e;
+  EIO_STRUCT_STAT st;
+  int result, errorno;
 
-  req->result = -1;
+  X_LOCK (eio_statcache_lock);
 
-  if (!(flags & EIO_READDIR_DENTS))
-    flags &= ~(EIO_READDIR_DIRS_FIRST | EIO_READDIR_STAT_ORDER);
+  for (e = eio_statcache_hash ? eio_statcache_hash [hash & eio_statcache_mask] : 0; e; e = e->hnext)
+    if (e->hash == hash && e->wd == req->wd && e->type == req->type && !strcmp (e->path, req->ptr1))
+      break;
 
-#ifdef _WIN32
-  {
-    int len = strlen ((const char *)req->ptr1);
-    char *path = malloc (MAX_PATH);
-    const char *fmt;
-    const char *reqpath = wd_expand (&self->tmpbuf, req->wd, req->ptr1);
-
-    if (!len)
-      fmt = "./*";
-    else if (reqpath[len - 1] == '/' || reqpath[len - 1] == '\\')
-      fmt = "%s*";
-    else
-      fmt = "%s/*";
-
-    _snprintf (path, MAX_PATH, fmt, reqpath);
-    dirp = FindFirstFile (path, &entp);
-    free (path);
-
-    if (dirp == INVALID_HANDLE_VALUE)
-     {
-       /* should steal _dosmaperr */
-       switch (GetLastError ())
-         {
-           case ERROR_FILE_NOT_FOUND:
-             req->result = 0;
-             break;
-
-           case ERROR_INVALID_NAME:
-           case ERROR_PATH_NOT_FOUND:
-           case ERROR_NO_MORE_FILES:
-             errno = ENOENT;
-             break;
-
-           case ERROR_NOT_ENOUGH_MEMORY:
-             errno = ENOMEM;
-             break;
-
-           default:
-             errno = EINVAL;
-             break;
-         }
-
-       return;
-     }
-  }
-#else
-  #if HAVE_AT
+  if (e && e->expires && e->expires <= eio__now ())
     {
-      int fd = openat (WD2FD (req->wd), req->ptr1, O_CLOEXEC | O_SEARCH | O_DIRECTORY | O_NONBLOCK);
+      eio__statcache_unlink (e);
+      e = 0;
+    }
 
-      if (fd < 0)
-        return;
+  if (!e)
+    {
+      X_UNLOCK (eio_statcache_lock);
+      return 0;
+    }
 
-      dirp = fdopendir (fd);
+  if (e->prev)
+    {
+      e->prev->next = e->next;
+      if (e->next) e->next->prev = e->prev; else eio_statcache_last = e->prev;
 
-      if (!dirp)
-        {
-          silent_close (fd);
-          return;
-        }
+      e->prev = 0;
+      e->next = eio_statcache_first;
+      eio_statcache_first->prev = e;
+      eio_statcache_first = e;
     }
-  #else
-    dirp = opendir (wd_expand (&self->tmpbuf, req->wd, req->ptr1));
 
-    if (!dirp)
-      return;
-  #endif
-#endif
+  result  = e->result;
+  errorno = e->errorno;
+  st      = e->st;
 
-  if (req->flags & EIO_FLAG_PTR1_FREE)
-    free (req->ptr1);
+  X_UNLOCK (eio_statcache_lock);
 
-  req->flags |= EIO_FLAG_PTR1_FREE | EIO_FLAG_PTR2_FREE;
-  req->ptr1 = dents = flags ? malloc (dentalloc * sizeof (eio_dirent)) : 0;
-  req->ptr2 = names = malloc (namesalloc);
+  if (!result && !req->ptr2)
+    {
+      req->ptr2 = malloc (sizeof st);
 
-  if (!names || (flags && !dents))
-    return;
+      if (!req->ptr2)
+        return 0;
 
-  for (;;)
-    {
-      int done;
+      req->flags |= EIO_FLAG_PTR2_FREE;
+    }
 
-#ifdef _WIN32
-      done = !dirp;
-#else
-      errno = 0;
-      entp = readdir (dirp);
-      done = !entp;
-#endif
+  if (!result)
+    memcpy (req->ptr2, &st, sizeof st);
 
-      if (done)
-        {
-#ifndef _WIN32
-          int old_errno = errno;
-          closedir (dirp);
-          errno = old_errno;
+  req->result  = result;
+  req->errorno = errorno;
 
-          if (errno)
-            break;
-#endif
+  return 1;
+}
 
-          /* sort etc. */
-          req->int1   = flags;
-          req->result = dentoffs;
+/* called before a worker stats req->ptr1: watches its directory, so */
+/* that changes are reported from now on, and remembers the generation */
+static void
+eio__statcache_watch (etp_worker *self, eio_req *req)
+{
+  req->int3 = -1; /* no watch */
 
-          if (flags & EIO_READDIR_STAT_ORDER)
-            eio_dent_sort (dents, dentoffs, flags & EIO_READDIR_DIRS_FIRST ? 7 : 0, inode_bits);
-          else if (flags & EIO_READDIR_DIRS_FIRST)
-            if (flags & EIO_READDIR_FOUND_UNKNOWN)
-              eio_dent_sort (dents, dentoffs, 7, inode_bits); /* sort by score and inode */
-            else
-              {
-                /* in this case, all is known, and we just put dirs first and sort them */
-                eio_dirent *oth = dents + dentoffs;
-                eio_dirent *dir = dents;
+#if HAVE_INOTIFY
+  {
+    const char *path = req->ptr1;
+    const char *base = strrchr (path, '/');
+    int dlen = base ? base - path : 0;
+    int plen = path [0] != '/' && req->wd ? req->wd->len + 1 : 0;
+    char *dir;
+    int wd;
+
+    if (eio_statcache_fd < 0)
+      return;
 
-                /* now partition dirs to the front, and non-dirs to the back */
-                /* by walking from both sides and swapping if necessary */
-                while (oth > dir)
-                  {
-                    if (dir->type == EIO_DT_DIR)
-                      ++dir;
-                    else if ((--oth)->type == EIO_DT_DIR)
-                      {
-                        eio_dirent tmp = *dir; *dir = *oth; *oth = tmp;
+    /* "" for the cwd, and "/" for the root directory */
+    if (!dlen && !plen)
+      dlen = base ? 1 : 0;
 
-                        ++dir;
-                      }
-                  }
+    dir = etp_tmpbuf_get (&self->tmpbuf, plen + dlen + 2);
+
+    if (!dir)
+      return;
+
+    if (plen)
+      {
+        memcpy (dir, req->wd->str, plen - 1);
+        dir [plen - 1] = '/';
+      }
+
+    memcpy (dir + plen, path, dlen);
+    dir [plen + dlen] = 0;
+
+    if (!plen && !dlen)
+      strcpy (dir, ".");
 
-                /* now sort the dirs only (dirs all have the same score) */
-                eio_dent_sort (dents, dir - dents, 0, inode_bits);
-              }
+    wd = inotify_add_watch (eio_statcache_fd, dir, EIO_STATCACHE_EVENTS);
 
-          break;
-        }
+    if (wd < 0)
+      return;
 
-      /* now add the entry to our list(s) */
-      name = D_NAME (entp);
+    X_LOCK (eio_statcache_lock);
 
-      /* skip . and .. entries */
-      if (name [0] != '.' || (name [1] && (name [1] != '.' || name [2])))
+    {
+      struct eio_statwatch *w = eio__statcache_find_watch (wd);
+
+      if (!w)
         {
-          int len = D_NAMLEN (entp) + 1;
+          w = (struct eio_statwatch *)calloc (1, sizeof *w);
 
-          while (ecb_expect_false (namesoffs + len > namesalloc))
+          if (w)
             {
-              namesalloc *= 2;
-              req->ptr2 = names = realloc (names, namesalloc);
+              unsigned int slot = (unsigned int)wd % EIO_STATCACHE_WATCH_SLOTS;
 
-              if (!names)
-                break;
+              w->wd   = wd;
+              w->next = eio_statcache_watches [slot];
+              eio_statcache_watches [slot] = w;
             }
+        }
 
-          memcpy (names + namesoffs, name, len);
+      if (w)
+        {
+          ++w->refcnt;
+          req->int2 = w->gen;
+          req->int3 = wd;
+        }
+    }
 
-          if (dents)
-            {
-              struct eio_dirent *ent;
+    X_UNLOCK (eio_statcache_lock);
+  }
+#endif
+}
 
-              if (ecb_expect_false (dentoffs == dentalloc))
-                {
-                  dentalloc *= 2;
-                  req->ptr1 = dents = realloc (dents, dentalloc * sizeof (eio_dirent));
+/* called after a worker has stat'ed req->ptr1, enters the result into the cache */
+static void
+eio__statcache_put (eio_req *req)
+{
+  int saved_errno = errno;
+  int errorno = req->result ? errno : 0;
+  struct eio_statwatch *w = 0;
+  const char *base = strrchr (req->ptr1, '/');
+  int cache;
 
-                  if (!dents)
-                    break;
-                }
+  base = base ? base + 1 : req->ptr1;
 
-              ent = dents + dentoffs;
+  /* other errors, like EACCES or EIO, are not reported by watches */
+  cache = req->result ? errorno == ENOENT || errorno == ENOTDIR : !!req->ptr2;
 
-              ent->nameofs = namesoffs; /* rather dirtily we store the offset in the pointer */
-              ent->namelen = len - 1;
-              ent->inode   = D_INO (entp);
+  /* the watch is on the directory containing the name, not its parent */
+  if (!*base || (base [0] == '.' && (!base [1] || (base [1] == '.' && !base [2]))))
+    cache = 0;
 
-              inode_bits |= ent->inode;
+  /* whatever a symlink points to is not watched */
+  if (cache && req->type == EIO_STAT)
+    {
+      EIO_STRUCT_STAT lst;
 
-              switch (D_TYPE (entp))
-                {
-                  default:
-                    ent->type = EIO_DT_UNKNOWN;
-                    flags |= EIO_READDIR_FOUND_UNKNOWN;
-                    break;
-
-                  #ifdef DT_FIFO
-                    case DT_FIFO: ent->type = EIO_DT_FIFO; break;
-                  #endif
-                  #ifdef DT_CHR
-                    case DT_CHR:  ent->type = EIO_DT_CHR;  break;
-                  #endif
-                  #ifdef DT_MPC
-                    case DT_MPC:  ent->type = EIO_DT_MPC;  break;
-                  #endif
-                  #ifdef DT_DIR
-                    case DT_DIR:  ent->type = EIO_DT_DIR;  break;
-                  #endif
-                  #ifdef DT_NAM
-                    case DT_NAM:  ent->type = EIO_DT_NAM;  break;
-                  #endif
-                  #ifdef DT_BLK
-                    case DT_BLK:  ent->type = EIO_DT_BLK;  break;
-                  #endif
-                  #ifdef DT_MPB
-                    case DT_MPB:  ent->type = EIO_DT_MPB;  break;
-                  #endif
-                  #ifdef DT_REG
-                    case DT_REG:  ent->type = EIO_DT_REG;  break;
-                  #endif
-                  #ifdef DT_NWK
-                    case DT_NWK:  ent->type = EIO_DT_NWK;  break;
-                  #endif
-                  #ifdef DT_CMP
-                    case DT_CMP:  ent->type = EIO_DT_CMP;  break;
-                  #endif
-                  #ifdef DT_LNK
-                    case DT_LNK:  ent->type = EIO_DT_LNK;  break;
-                  #endif
-                  #ifdef DT_SOCK
-                    case DT_SOCK: ent->type = EIO_DT_SOCK; break;
-                  #endif
-                  #ifdef DT_DOOR
-                    case DT_DOOR: ent->type = EIO_DT_DOOR; break;
-                  #endif
-                  #ifdef DT_WHT
-                    case DT_WHT:  ent->type = EIO_DT_WHT;  break;
-                  #endif
-                }
+      int res;
 
-              ent->score = 7;
+      #if HAVE_AT
+      res = fstatat (WD2FD (req->wd), req->ptr1, &lst, AT_SYMLINK_NOFOLLOW);
+      #else
+      {
+        struct etp_tmpbuf tmpbuf = { 0 };
+        res = lstat (wd_expand (&tmpbuf, req->wd, req->ptr1), &lst);
+        free (tmpbuf.ptr);
+      }
+      #endif
 
-              if (flags & EIO_READDIR_DIRS_FIRST)
-                {
-                  if (ent->type == EIO_DT_UNKNOWN)
-                    {
-                      if (*name == '.') /* leading dots are likely directories, and, in any case, rare */
-                        ent->score = 1;
-                      else if (!strchr (name, '.')) /* absence of dots indicate likely dirs */
-                        ent->score = len <= 2 ? 4 - len : len <= 4 ? 4 : len <= 7 ? 5 : 6; /* shorter == more likely dir, but avoid too many classes */
-                    }
-                  else if (ent->type == EIO_DT_DIR)
-                    ent->score = 0;
-                }
-            }
+      cache = res ? errno == errorno : !S_ISLNK (lst.st_mode);
+    }
 
-          namesoffs += len;
-          ++dentoffs;
-        }
+  X_LOCK (eio_statcache_lock);
 
-      if (EIO_CANCELLED (req))
-        {
-          errno = ECANCELED;
-          break;
-        }
+  if (req->int3 >= 0)
+    {
+      w = eio__statcache_find_watch (req->int3);
 
-#ifdef _WIN32
-      if (!FindNextFile (dirp, &entp))
+      /* only cache the result when nothing happened since the watch was added */
+      if (w->dead || w->gen != (unsigned int)req->int2)
+        cache = 0;
+    }
+  else if (!eio_statcache_ttl)
+    cache = 0;
+
+  if (cache && eio_statcache_max)
+    {
+      unsigned int hash = eio__statcache_hashof (req->wd, req->type, req->ptr1);
+      int len = strlen (req->ptr1);
+      struct eio_statent *e;
+
+      for (e = eio_statcache_hash [hash & eio_statcache_mask]; e; e = e->hnext)
+        if (e->hash == hash && e->wd == req->wd && e->type == req->type && !strcmp (e->path, req->ptr1))
+          {
+            eio__statcache_unlink (e);
+            break;
+          }
+
+      e = (struct eio_statent *)malloc (sizeof *e + len);
+
+      if (e)
         {
-          FindClose (dirp);
-          dirp = 0;
+          e->wd      = req->wd;
+          e->hash    = hash;
+          e->type    = req->type;
+          e->result  = req->result;
+          e->errorno = errorno;
+          e->expires = eio_statcache_ttl ? eio__now () + eio_statcache_ttl : 0.;
+          memcpy (e->path, req->ptr1, len + 1);
+
+          if (!req->result)
+            e->st = *(EIO_STRUCT_STAT *)req->ptr2;
+
+          e->hnext = eio_statcache_hash [hash & eio_statcache_mask];
+          eio_statcache_hash [hash & eio_statcache_mask] = e;
+
+          e->prev = 0;
+          e->next = eio_statcache_first;
+          if (e->next) e->next->prev = e; else eio_statcache_last = e;
+          eio_statcache_first = e;
+
+          /* the entry takes over the reference to the watch */
+          e->watch = w;
+
+          if (w)
+            {
+              e->wprev = 0;
+              e->wnext = w->ents;
+              if (e->wnext) e->wnext->wprev = e;
+              w->ents = e;
+
+              w = 0;
+            }
+
+          if (++eio_statcache_count > eio_statcache_max)
+            eio__statcache_unlink (eio_statcache_last);
         }
-#endif
     }
+
+  if (w)
+    eio__statcache_unwatch (w);
+
+  X_UNLOCK (eio_statcache_lock);
+
+  errno = saved_errno;
 }
 
+#define REQ(rtype)						\
+  eio_req *req;                                                 \
+                                                                \
+  req = (eio_req *)calloc (1, sizeof *req);                     \
+  if (!req)                                                     \
+    return 0;                                                   \
+                                                                \
+  req->type    = rtype;                                         \
+  req->pri     = pri;						\
+  req->finish  = cb;						\
+  req->data    = data;						\
+  req->destroy = eio_api_destroy;
+
+#define SEND eio_submit (req); return req
+
+#define PATH							\
+  req->flags |= EIO_FLAG_PTR1_FREE;				\
+  req->ptr1 = strdup (path);					\
+  if (!req->ptr1)						\
+    {								\
+      eio_api_destroy (req);					\
+      return 0;							\
+    }
+
+#define SINGLEDOT(ptr) (0[(char *)(ptr)] == '.' && !1[(char *)(ptr)])
+
 /*****************************************************************************/
-/* working directory stuff */
-/* various deficiencies in the posix 2008 api force us to */
-/* keep the absolute path in string form at all times */
-/* fuck yeah. */
+/* executing requests in the submitting thread when they would not block */
 
-#if !HAVE_AT
+static int eio_inline_flags;
 
-/* a bit like realpath, but usually faster because it doesn't have to return */
-/* an absolute or canonical path */
-static const char *
-wd_expand (struct etp_tmpbuf *tmpbuf, eio_wd wd, const char *path)
+void ecb_cold
+eio_set_inline (int flags)
 {
-  if (!wd || *path == '/')
-    return path;
-
-  if (path [0] == '.' && !path [1])
-    return wd->str;
+  eio_inline_flags = flags;
+}
 
-  {
-    int l1 = wd->len;
-    int l2 = strlen (path);
+/* RESOLVE_CACHED only covers the lookup, stat and open can still wait for */
+/* a server on network or fuse filesystems, so only local ones are used */
+#define EIO_INLINE_PATH (HAVE_AT && HAVE_OPENAT2 && HAVE_STATX)
 
-    char *res = etp_tmpbuf_get (tmpbuf, l1 + l2 + 2);
+#if EIO_INLINE_PATH
 
-    memcpy (res, wd->str, l1);
-    res [l1] = '/';
-    memcpy (res + l1 + 1, path, l2 + 1);
+#define EIO_LOCALDEV_SLOTS 16 /* devices remembered, direct-mapped */
 
-    return res;
-  }
-}
+struct eio_localdev
+{
+  dev_t dev;
+  unsigned char state; /* 0 unknown, 1 local, 2 anything else */
+};
 
-#endif
+static xmutex_t eio_localdev_lock = X_MUTEX_INIT;
+static struct eio_localdev eio_localdev [EIO_LOCALDEV_SLOTS];
 
-static eio_wd
-eio__wd_open_sync (struct etp_tmpbuf *tmpbuf, eio_wd wd, const char *path)
+static int
+eio__localdev_state (dev_t dev)
 {
-  int fd;
-  eio_wd res;
-  int len = eio__realpath (tmpbuf, wd, path);
+  struct eio_localdev *ld = eio_localdev + (unsigned int)dev % EIO_LOCALDEV_SLOTS;
+  int state;
 
-  if (len < 0)
-    return EIO_INVALID_WD;
+  X_LOCK (eio_localdev_lock);
+  state = ld->state && ld->dev == dev ? ld->state : 0;
+  X_UNLOCK (eio_localdev_lock);
 
-#if HAVE_AT
-  fd = openat (WD2FD (wd), path, O_CLOEXEC | O_SEARCH | O_DIRECTORY | O_NONBLOCK);
+  return state;
+}
 
-  /* 0 is a valid fd, but we use it for EIO_CWD, so in the very unlikely */
-  /* case of fd 0 being available (almost certainly an a pplication bug) */
-  /* make sure we use another fd value */
-  #if EIO_CWD
-    error EIO_CWD must be 0
-  #endif
-  if (ecb_expect_false (fd == 0))
+/* called by workers, which may block in fstatfs, after opening or stating */
+/* a path that an inline request would have used, with an fd for it */
+static void
+eio__localdev_learn (int fd)
+{
+  EIO_STRUCT_STAT st;
+  struct statfs sfs;
+  struct eio_localdev *ld;
+  int errorno = errno;
+  int local;
+
+  if (fstat (fd, &st) || eio__localdev_state (st.st_dev) || fstatfs (fd, &sfs))
     {
-      int fd2 = fcntl (fd, F_DUPFD_CLOEXEC ? F_DUPFD_CLOEXEC : F_DUPFD);
-      fcntl (fd2, F_SETFD, FD_CLOEXEC);
-      eio__close (fd);
-      fd = fd2;
+      errno = errorno;
+      return;
     }
 
-  if (fd < 0)
-    return EIO_INVALID_WD;
-#endif
+  switch ((unsigned long)sfs.f_type)
+    {
+      case 0xef53:     /* ext2, ext3, ext4 */
+      case 0x58465342: /* xfs */
+      case 0x9123683e: /* btrfs */
+      case 0xf2f52010: /* f2fs */
+      case 0x01021994: /* tmpfs */
+        local = 1;
+        break;
 
-  res = malloc (sizeof (*res) + len); /* one extra 0-byte */
+      default:
+        local = 0;
+        break;
+    }
 
-#if HAVE_AT
-  res->fd = fd;
-#endif
+  ld = eio_localdev + (unsigned int)st.st_dev % EIO_LOCALDEV_SLOTS;
 
-  res->len = len;
-  memcpy (res->str, tmpbuf->ptr, len);
-  res->str [len] = 0;
+  X_LOCK (eio_localdev_lock);
+  ld->dev   = st.st_dev;
+  ld->state = local ? 1 : 2;
+  X_UNLOCK (eio_localdev_lock);
 
-  return res;
+  errno = errorno;
 }
 
-eio_wd
-eio_wd_open_sync (eio_wd wd, const char *path)
+/* after a worker executed an open or stat relative to dirfd, learns about its filesystem */
+static void
+eio__localdev_learn_req (int dirfd, eio_req *req)
 {
-  struct etp_tmpbuf tmpbuf = { 0 };
-  wd = eio__wd_open_sync (&tmpbuf, wd, path);
-  free (tmpbuf.ptr);
+  if (req->type == EIO_OPEN)
+    eio__localdev_learn (req->result);
+  else if (!eio__localdev_state (((EIO_STRUCT_STAT *)req->ptr2)->st_dev))
+    {
+      int errorno = errno;
+      int fd = openat (dirfd, req->ptr1,
+                       O_PATH | O_CLOEXEC | (req->type == EIO_LSTAT ? O_NOFOLLOW : 0));
 
-  return wd;
-}
+      if (fd >= 0)
+        {
+          eio__localdev_learn (fd);
+          eio__close (fd);
+        }
 
-void
-eio_wd_close_sync (eio_wd wd)
-{
-  if (wd != EIO_INVALID_WD && wd != EIO_CWD)
-    {
-      #if HAVE_AT
-      eio__close (wd->fd);
-      #endif
-      free (wd);
+      errno = errorno;
     }
 }
 
-#if HAVE_AT
-
+/* non-zero if fd is on a filesystem known to be local, without asking a server */
 static int
-eio__renameat2 (int olddirfd, const char *oldpath, int newdirfd, const char *newpath, unsigned int flags)
+eio__inline_local (int fd)
 {
-#if HAVE_RENAMEAT2
-  return syscall (SYS_renameat2, olddirfd, oldpath, newdirfd, newpath, flags);
-#else
-  if (flags)
-    return EIO_ENOSYS ();
+  struct statx stx;
 
-  return renameat (olddirfd, oldpath, newdirfd, newpath);
-#endif
+  return !statx (fd, "", AT_EMPTY_PATH | AT_STATX_DONT_SYNC, 0, &stx)
+         && eio__localdev_state (makedev (stx.stx_dev_major, stx.stx_dev_minor)) == 1;
 }
 
-/* they forgot these */
+/* openat, but fails with EAGAIN instead of blocking during path resolution */
+static int
+eio__openat_cached (int dirfd, const char *path, int flags)
+{
+  struct open_how how;
+
+  memset (&how, 0, sizeof how);
+  how.flags   = flags;
+  how.resolve = RESOLVE_CACHED;
+
+  return syscall (SYS_openat2, dirfd, path, &how, sizeof how);
+}
 
+/* finishes req with the current errno, unless it means trying would block */
 static int
-eio__truncateat (int dirfd, const char *path, off_t length)
+eio__inline_error (eio_req *req)
 {
-  int fd = openat (dirfd, path, O_WRONLY | O_CLOEXEC | O_NONBLOCK);
-  int res;
+  if (errno == EAGAIN || errno == ENOSYS || errno == EINVAL || errno == E2BIG)
+    return 0;
 
-  if (fd < 0)
-    return fd;
+  req->result  = -1;
+  req->errorno = errno;
 
-  res = ftruncate (fd, length);
-  silent_close (fd);
-  return res;
+  return 1;
 }
 
+/* opens or stats a path when the lookup only needs the dentry cache */
 static int
-eio__statvfsat (int dirfd, const char *path, struct statvfs *buf)
+eio__inline_path (eio_req *req)
 {
-  int fd = openat (dirfd, path, O_SEARCH | O_CLOEXEC | O_NONBLOCK);
-  int res;
+  int dirfd = WD2FD (req->wd);
+  EIO_STRUCT_STAT st;
+  int fd, res;
+
+  if (req->type == EIO_OPEN)
+    {
+      if (!(eio_inline_flags & EIO_INLINE_OPEN) || req->int1 & (O_CREAT | O_TRUNC))
+        return 0;
+
+      #ifdef O_TMPFILE
+      if ((req->int1 & O_TMPFILE) == O_TMPFILE)
+        return 0;
+      #endif
+    }
+  else if (!(eio_inline_flags & EIO_INLINE_STAT))
+    return 0;
+
+  /* find out what the path refers to without opening it */
+  fd = eio__openat_cached (dirfd, req->ptr1, O_PATH | O_CLOEXEC
+                           | (req->type == EIO_LSTAT || (req->type == EIO_OPEN && req->int1 & O_NOFOLLOW) ? O_NOFOLLOW : 0));
 
   if (fd < 0)
-    return fd;
+    return eio__inline_error (req);
 
-  res = fstatvfs (fd, buf);
-  silent_close (fd);
-  return res;
-}
+  if (!eio__inline_local (fd))
+    {
+      close (fd);
+      return 0;
+    }
+
+  res = fstat (fd, &st);
+  close (fd);
+
+  if (res)
+    return 0;
+
+  if (req->type != EIO_OPEN)
+    {
+      if (!req->ptr2)
+        {
+          req->ptr2 = malloc (sizeof st);
+
+          if (!req->ptr2)
+            return 0;
 
-#endif
+          req->flags |= EIO_FLAG_PTR2_FREE;
+        }
 
-/*****************************************************************************/
+      memcpy (req->ptr2, &st, sizeof st);
+      req->result  = 0;
+      req->errorno = 0;
 
-#define ALLOC(len)				\
-  if (!req->ptr2)				\
-    {						\
-      X_LOCK (EIO_POOL->wrklock);		\
-      req->flags |= EIO_FLAG_PTR2_FREE;		\
-      X_UNLOCK (EIO_POOL->wrklock);		\
-      req->ptr2 = malloc (len);			\
-      if (!req->ptr2)				\
-        {					\
-          errno       = ENOMEM;			\
-          req->result = -1;			\
-          goto alloc_fail;			\
-        }					\
+      return 1;
     }
 
-/*****************************************************************************/
+  /* only possible with O_NOFOLLOW */
+  if (S_ISLNK (st.st_mode))
+    {
+      req->result  = -1;
+      req->errorno = ELOOP;
 
-static void
-eio__slurp (int fd, eio_req *req)
-{
-  req->result = fd;
+      return 1;
+    }
 
-  if (fd < 0)
-    return;
+  /* opening anything but files and directories might block or have side effects */
+  if (!S_ISREG (st.st_mode) && !S_ISDIR (st.st_mode))
+    return 0;
 
-  if (req->offs < 0 || !req->size) /* do we need the size? */
-    {
-      off_t size = lseek (fd, 0, SEEK_END);
+  fd = eio__openat_cached (dirfd, req->ptr1, req->int1 | O_NONBLOCK);
 
-      if (req->offs < 0)
-        req->offs += size;
+  if (fd < 0)
+    return eio__inline_error (req);
 
-      if (!req->size)
-        req->size = size - req->offs;
+  /* the path might have been replaced meanwhile */
+  if (fstat (fd, &st) || (!S_ISREG (st.st_mode) && !S_ISDIR (st.st_mode)))
+    {
+      close (fd);
+      return 0;
     }
 
-  ALLOC (req->size);
-  req->result = pread (fd, req->ptr2, req->size, req->offs);
+  if (!(req->int1 & O_NONBLOCK))
+    fcntl (fd, F_SETFL, fcntl (fd, F_GETFL) & ~O_NONBLOCK);
 
-  silent_close (fd);
+  req->result  = fd;
+  req->errorno = 0;
 
-alloc_fail:
-  ;
+  return 1;
 }
 
-int ecb_cold
-eio_init (void (*want_poll)(void), void (*done_poll)(void))
+#endif
+
+/* tries to execute req without blocking, returns non-zero if it was executed */
+static int
+eio_inline (eio_req *req)
 {
-  eio_want_poll_cb = want_poll;
-  eio_done_poll_cb = done_poll;
+  /* on a miss, a worker has to stat the path, so that the result gets cached */
+  if (ecb_expect_false (eio_statcache_max)
+      && (req->type == EIO_STAT || req->type == EIO_LSTAT)
+      && req->wd != EIO_INVALID_WD)
+    return eio__statcache_get (req);
+
+#if HAVE_PREADV2
+  /* reads at the file position cannot be retried after a partial read, */
+  /* and drop-behind mode needs the worker */
+  if (ecb_expect_false (eio_inline_flags & EIO_INLINE_READ)
+      && req->type == EIO_READ && req->offs >= 0 && !eio_dropbehind_count)
+    {
+      struct iovec iov;
+      eio_ssize_t res;
+      int errorno = errno; /* the submitter's errno is left alone */
 
-  return etp_init (EIO_POOL, 0, 0, 0);
-}
+      if (!req->ptr2)
+        {
+          req->ptr2 = malloc (req->size);
 
-ecb_inline void
-eio_api_destroy (eio_req *req)
-{
-  free (req);
-}
+          if (!req->ptr2)
+            {
+              errno = errorno;
+              return 0;
+            }
 
-#define REQ(rtype)						\
-  eio_req *req;                                                 \
-                                                                \
-  req = (eio_req *)calloc (1, sizeof *req);                     \
-  if (!req)                                                     \
-    return 0;                                                   \
-                                                                \
-  req->type    = rtype;                                         \
-  req->pri     = pri;						\
-  req->finish  = cb;						\
-  req->data    = data;						\
-  req->destroy = eio_api_destroy;
+          req->flags |= EIO_FLAG_PTR2_FREE;
+        }
 
-#define SEND eio_submit (req); return req
+      iov.iov_base = req->ptr2;
+      iov.iov_len  = req->size;
 
-#define PATH							\
-  req->flags |= EIO_FLAG_PTR1_FREE;				\
-  req->ptr1 = strdup (path);					\
-  if (!req->ptr1)						\
-    {								\
-      eio_api_destroy (req);					\
-      return 0;							\
+      /* with RWF_NOWAIT, a partial read might just be partially cached data */
+      res = eio__rwv (0, req->int1, &iov, 1, req->offs, EIO_RWF_NOWAIT);
+      errno = errorno;
+
+      if (res == (eio_ssize_t)req->size || !res)
+        {
+          req->result  = res;
+          req->errorno = 0;
+
+          /* issuing readahead is left to a worker, which reads again */
+          if (eio_max_readahead_window && res && !eio__ratrack (0, req))
+            return 0;
+
+          return 1;
+        }
     }
+#endif
 
-#define SINGLEDOT(ptr) (0[(char *)(ptr)] == '.' && !1[(char *)(ptr)])
+#if EIO_INLINE_PATH
+  if (ecb_expect_false (eio_inline_flags & (EIO_INLINE_OPEN | EIO_INLINE_STAT))
+      && (req->type == EIO_OPEN || req->type == EIO_STAT || req->type == EIO_LSTAT)
+      && req->wd != EIO_INVALID_WD)
+    {
+      int errorno = errno;
+      int res = eio__inline_path (req);
+
+      errno = errorno;
+      return res;
+    }
+#endif
+
+#ifndef _WIN32
+  /* reads are compared by file in eio_coalesce, which cannot call fstat */
+  if (ecb_expect_false (eio_max_read_coalesce) && req->type == EIO_READ && req->offs >= 0)
+    eio__fileid (req);
+#endif
+
+  return 0;
+}
 
 static void
 eio_execute (etp_worker *self, eio_req *req)
 {
 #if HAVE_AT
   int dirfd;
+  struct eio_dirfd *dircache = 0;
+  void *dirpath;
 #else
   const char *path;
 #endif
 
+#ifndef _WIN32
+  /* coalesced requests have to be executed together, even when cancelled */
+  if (ecb_expect_false (req->flags & EIO_FLAG_COALESCED))
+    {
+      if (req->type == EIO_WRITE)
+        eio__write_coalesced (self, req);
+      else
+        eio__read_coalesced (self, req);
+
+      return;
+    }
+#endif
+
   if (ecb_expect_false (EIO_CANCELLED (req)))
     {
       req->result  = -1;
@@ -1892,10 +6295,24 @@ eio_execute (etp_worker *self, eio_req *req)
       return;
     }
 
+  if (ecb_expect_false (eio_statcache_max) && (req->type == EIO_STAT || req->type == EIO_LSTAT))
+    eio__statcache_watch (self, req);
+
   if (req->type >= EIO_OPEN)
     {
       #if HAVE_AT
         dirfd = WD2FD (req->wd);
+
+        /* requests with a second path are left alone */
+        if (ecb_expect_false (eio_dircache_max) && !req->wd && *(char *)req->ptr1 == '/'
+            && req->type != EIO_RENAME && req->type != EIO_LINK && req->type != EIO_SYMLINK
+            && (dircache = eio__dircache_get (&self->tmpbuf, req)))
+          {
+            /* the callback has to see the original path again */
+            dirpath   = req->ptr1;
+            req->ptr1 = strrchr (dirpath, '/') + 1;
+            dirfd     = dircache->fd;
+          }
       #else
         path = wd_expand (&self->tmpbuf, req->wd, req->ptr1);
       #endif
@@ -1912,17 +6329,31 @@ eio_execute (etp_worker *self, eio_req *req)
       case EIO_SEEK:      eio__lseek (req); break;
       case EIO_READ:      ALLOC (req->size);
                           req->result = req->offs >= 0
-                                      ? pread     (req->int1, req->ptr2, req->size, req->offs)
-                                      : read      (req->int1, req->ptr2, req->size); break;
+                                      ? eio__prw  (self, req, 0, req->int1, req->ptr2, req->size, req->offs)
+                                      : read      (req->int1, req->ptr2, req->size);
+
+                          if (eio_max_readahead_window && req->offs >= 0 && req->result > 0)
+                            eio__ratrack (self, req);
+
+                          break;
       case EIO_WRITE:     req->result = req->offs >= 0
-                                      ? pwrite    (req->int1, req->ptr2, req->size, req->offs)
+                                      ? eio__prw  (self, req, 1, req->int1, req->ptr2, req->size, req->offs)
                                       : write     (req->int1, req->ptr2, req->size); break;
+#ifndef _WIN32
+      case EIO_READV:     req->result = eio__rwv (0, req->int1, req->ptr2, req->int2, req->offs, req->int3); break;
+      case EIO_WRITEV:    req->result = eio__rwv (1, req->int1, req->ptr2, req->int2, req->offs, req->int3); break;
+#else
+      case EIO_READV:
+      case EIO_WRITEV:    req->result = EIO_ENOSYS (); break;
+#endif
 
       case EIO_FCNTL:     req->result = fcntl     (req->int1, (int)          req->int2, req->ptr2); break;
       case EIO_IOCTL:     req->result = ioctl     (req->int1, (unsigned long)req->int2, req->ptr2); break;
 
       case EIO_READAHEAD: req->result = readahead     (req->int1, req->offs, req->size); break;
-      case EIO_SENDFILE:  req->result = eio__sendfile (req->int1, req->int2, req->offs, req->size); break;
+      case EIO_FADVISE:   req->result = eio__fadvise  (req->int1, req->offs, req->size, req->int2, self); break;
+      case EIO_SENDFILE:  req->result = eio__sendfile (req->int1, req->int2, req->offs, req->size, self); break;
+      case EIO_COPYFILE:  req->result = eio__copyfile (req->int1, req->int2, req->int3, self); break;
 
 #if HAVE_AT
 
@@ -1934,7 +6365,7 @@ eio_execute (etp_worker *self, eio_req *req)
       case EIO_CHMOD:     req->result = fchmodat  (dirfd, req->ptr1, (mode_t)req->int2, 0); break;
       case EIO_TRUNCATE:  req->result = eio__truncateat (dirfd, req->ptr1, req->offs); break;
       case EIO_OPEN:      req->result = openat    (dirfd, req->ptr1, req->int1, (mode_t)req->int2); break;
-      case EIO_SLURP:     eio__slurp (  openat    (dirfd, req->ptr1, O_RDONLY | O_CLOEXEC), req); break;
+      case EIO_SLURP:     eio__slurp (  openat    (dirfd, req->ptr1, O_RDONLY | O_CLOEXEC), req, self); break;
 
       case EIO_UNLINK:    req->result = unlinkat  (dirfd, req->ptr1, 0); break;
       case EIO_RMDIR:     /* complications arise because "." cannot be removed, so we might have to expand */
@@ -1998,7 +6429,7 @@ eio_execute (etp_worker *self, eio_req *req)
       case EIO_CHMOD:     req->result = chmod     (path     , (mode_t)req->int2); break;
       case EIO_TRUNCATE:  req->result = truncate  (path     , req->offs); break;
       case EIO_OPEN:      req->result = open      (path     , req->int1, (mode_t)req->int2); break;
-      case EIO_SLURP:     eio__slurp (  open      (path     , O_RDONLY | O_CLOEXEC), req); break;
+      case EIO_SLURP:     eio__slurp (  open      (path     , O_RDONLY | O_CLOEXEC), req, self); break;
 
       case EIO_UNLINK:    req->result = unlink    (path     ); break;
       case EIO_RMDIR:     req->result = rmdir     (path     ); break;
@@ -2061,7 +6492,10 @@ eio_execute (etp_worker *self, eio_req *req)
       case EIO_FCHMOD:    req->result = fchmod    (req->int1, (mode_t)req->int2); break;
       case EIO_FTRUNCATE: req->result = ftruncate (req->int1, req->offs); break;
 
-      case EIO_CLOSE:     req->result = eio__close (req->int1); break;
+      case EIO_CLOSE:     if (ecb_expect_false (eio_dropbehind_count))
+                            eio_set_drop_behind (req->int1, 0);
+
+                          req->result = eio__close (req->int1); break;
       case EIO_DUP2:      req->result = dup2      (req->int1, req->int2); break;
       case EIO_SYNC:      req->result = 0; sync (); break;
       case EIO_FSYNC:     req->result = fsync     (req->int1); break;
@@ -2070,11 +6504,21 @@ eio_execute (etp_worker *self, eio_req *req)
       case EIO_SYNC_FILE_RANGE: req->result = eio__sync_file_range (req->int1, req->offs, req->size, req->int2); break;
       case EIO_MSYNC:     req->result = eio__msync (req->ptr2, req->size, req->int1); break;
       case EIO_MTOUCH:    req->result = eio__mtouch (req); break;
+      case EIO_MINCORE:   req->result = eio__mincore (self, req); break;
       case EIO_MLOCK:     req->result = eio__mlock (req->ptr2, req->size); break;
       case EIO_MLOCKALL:  req->result = eio__mlockall (req->int1); break;
       case EIO_FALLOCATE: req->result = eio__fallocate (req->int1, req->int2, req->offs, req->size); break;
 
       case EIO_READDIR:   eio__scandir (req, self); break;
+#if HAVE_AT
+      case EIO_TREEWALK:  eio__treewalk (req, self); break;
+      case EIO_RMTREE:    eio__treewalk (req, self); break;
+      case EIO_COPYTREE:  eio__treewalk (req, self); break;
+#else
+      case EIO_TREEWALK:  req->result = EIO_ENOSYS (); break;
+      case EIO_RMTREE:    req->result = EIO_ENOSYS (); break;
+      case EIO_COPYTREE:  req->result = EIO_ENOSYS (); break;
+#endif
 
       case EIO_BUSY:
 #ifdef _WIN32
@@ -2109,7 +6553,53 @@ eio_execute (etp_worker *self, eio_req *req)
         break;
     }
 
+  if (ecb_expect_false (eio_dropbehind_count) && req->result > 0
+      && (req->type == EIO_READ || req->type == EIO_WRITE
+          || req->type == EIO_READV || req->type == EIO_WRITEV
+          || req->type == EIO_SENDFILE))
+    eio__drop_behind (self, req);
+
+#if EIO_INLINE_PATH
+  /* inline opens and stats only use filesystems known to be local */
+  if (ecb_expect_false (eio_inline_flags & (EIO_INLINE_OPEN | EIO_INLINE_STAT))
+      && (req->type == EIO_OPEN || req->type == EIO_STAT || req->type == EIO_LSTAT)
+      && req->result >= 0)
+    eio__localdev_learn_req (dirfd, req);
+#endif
+
+#ifndef _WIN32
+  if (ecb_expect_false (eio_max_read_coalesce)
+      && (req->type == EIO_WRITE || req->type == EIO_WRITEV
+          || req->type == EIO_SENDFILE || req->type == EIO_COPYFILE
+          || req->type == EIO_FTRUNCATE || req->type == EIO_TRUNCATE
+          || req->type == EIO_FALLOCATE))
+    eio__rdinfl_close ();
+#endif
+
+  /* what was removed or renamed might be replaced by a symlink */
+  if (ecb_expect_false (eio_pathcache_max)
+      && ((req->type >= EIO_UNLINK && req->type <= EIO_RENAME) || req->type == EIO_RMTREE))
+    eio__pathcache_expire ();
+
+  /* and a directory, or a symlink to one, by another directory */
+  if (ecb_expect_false (eio_dircache_max)
+      && (req->type == EIO_UNLINK || req->type == EIO_RMDIR
+          || req->type == EIO_RENAME || req->type == EIO_RMTREE))
+    eio__dircache_flush ();
+
 alloc_fail:
+#if HAVE_AT
+  if (ecb_expect_false (dircache))
+    {
+      req->ptr1 = dirpath;
+      eio__dircache_put (dircache);
+    }
+#endif
+
+  /* int3 is only set when the stat cache was enabled before the stat */
+  if ((req->type == EIO_STAT || req->type == EIO_LSTAT) && req->int3)
+    eio__statcache_put (req);
+
   req->errorno = errno;
 }
 
@@ -2170,6 +6660,11 @@ eio_req *eio_mtouch (void *addr, size_t length, int flags, int pri, eio_cb cb, v
   REQ (EIO_MTOUCH); req->ptr2 = addr; req->size = length; req->int1 = flags; SEND;
 }
 
+eio_req *eio_mincore (int fd, off_t offset, size_t length, int flags, int pri, eio_cb cb, void *data)
+{
+  REQ (EIO_MINCORE); req->int1 = fd; req->offs = offset; req->size = length; req->int2 = flags; SEND;
+}
+
 eio_req *eio_mlock (void *addr, size_t length, int pri, eio_cb cb, void *data)
 {
   REQ (EIO_MLOCK); req->ptr2 = addr; req->size = length; SEND;
@@ -2195,6 +6690,11 @@ eio_req *eio_readahead (int fd, off_t offset, size_t length, int pri, eio_cb cb,
   REQ (EIO_READAHEAD); req->int1 = fd; req->offs = offset; req->size = length; SEND;
 }
 
+eio_req *eio_fadvise (int fd, off_t offset, size_t length, int advice, int pri, eio_cb cb, void *data)
+{
+  REQ (EIO_FADVISE); req->int1 = fd; req->offs = offset; req->size = length; req->int2 = advice; SEND;
+}
+
 eio_req *eio_seek (int fd, off_t offset, int whence, int pri, eio_cb cb, void *data)
 {
   REQ (EIO_SEEK); req->int1 = fd; req->offs = offset; req->int2 = whence; SEND;
@@ -2210,6 +6710,16 @@ eio_req *eio_write (int fd, void *buf, size_t length, off_t offset, int pri, eio
   REQ (EIO_WRITE); req->int1 = fd; req->offs = offset; req->size = length; req->ptr2 = buf; SEND;
 }
 
+eio_req *eio_readv (int fd, const struct iovec *iov, int iovcnt, off_t offset, int flags, int pri, eio_cb cb, void *data)
+{
+  REQ (EIO_READV); req->int1 = fd; req->offs = offset; req->ptr2 = (void *)iov; req->int2 = iovcnt; req->int3 = flags; SEND;
+}
+
+eio_req *eio_writev (int fd, const struct iovec *iov, int iovcnt, off_t offset, int flags, int pri, eio_cb cb, void *data)
+{
+  REQ (EIO_WRITEV); req->int1 = fd; req->offs = offset; req->ptr2 = (void *)iov; req->int2 = iovcnt; req->int3 = flags; SEND;
+}
+
 eio_req *eio_fcntl (int fd, int cmd, void *arg, int pri, eio_cb cb, void *data)
 {
   REQ (EIO_IOCTL); req->int1 = fd; req->int2 = cmd; req->ptr2 = arg; SEND;
@@ -2260,6 +6770,11 @@ eio_req *eio_sendfile (int out_fd, int in_fd, off_t in_offset, size_t length, in
   REQ (EIO_SENDFILE); req->int1 = out_fd; req->int2 = in_fd; req->offs = in_offset; req->size = length; SEND;
 }
 
+eio_req *eio_copyfile (int out_fd, int in_fd, int flags, int pri, eio_cb cb, void *data)
+{
+  REQ (EIO_COPYFILE); req->int1 = out_fd; req->int2 = in_fd; req->int3 = flags; SEND;
+}
+
 eio_req *eio_open (const char *path, int flags, mode_t mode, int pri, eio_cb cb, void *data)
 {
   REQ (EIO_OPEN); PATH; req->int1 = flags; req->int2 = (long)mode; SEND;
@@ -2336,6 +6851,11 @@ eio_req *eio_readdir (const char *path, int flags, int pri, eio_cb cb, void *dat
   REQ (EIO_READDIR); PATH; req->int1 = flags; SEND;
 }
 
+eio_req *eio_readdirplus (const char *path, int flags, int nthreads, int pri, eio_cb cb, void *data)
+{
+  REQ (EIO_READDIR); PATH; req->int1 = flags | EIO_READDIR_STAT; req->int2 = nthreads; SEND;
+}
+
 eio_req *eio_mknod (const char *path, mode_t mode, dev_t dev, int pri, eio_cb cb, void *data)
 {
   REQ (EIO_MKNOD); PATH; req->int2 = (long)mode; req->offs = (off_t)dev; SEND;
@@ -2377,6 +6897,11 @@ eio_req *eio_slurp (const char *path, void *buf, size_t length, off_t offset, in
   REQ (EIO_SLURP); PATH; req->offs = offset; req->size = length; req->ptr2 = buf; SEND;
 }
 
+eio_req *eio_slurp_mmap (const char *path, size_t length, off_t offset, int flags, int pri, eio_cb cb, void *data)
+{
+  REQ (EIO_SLURP); PATH; req->offs = offset; req->size = length; req->int1 = flags | EIO_SLURP_MMAP; SEND;
+}
+
 eio_req *eio_custom (void (*execute)(eio_req *), int pri, eio_cb cb, void *data)
 {
   REQ (EIO_CUSTOM); req->feed = execute; SEND;
@@ -2391,6 +6916,258 @@ eio_req *eio_grp (eio_cb cb, void *data)
   REQ (EIO_GROUP); SEND;
 }
 
+/*****************************************************************************/
+/* streams: groups that feed themselves with chunk requests sharing a state */
+
+#ifndef EIO_NO_WRAPPERS
+
+static void
+eio__dirstream_feed (eio_req *grp)
+{
+  struct eio_dirstream *stream = (struct eio_dirstream *)grp->ptr1;
+  eio_req *req;
+
+  if (stream->state == EIO_DIRSTREAM_DONE)
+    return;
+
+  req = (eio_req *)calloc (1, sizeof *req);
+
+  if (!req)
+    {
+      /* not adding a request ends the stream */
+      grp->result  = -1;
+      grp->errorno = ENOMEM;
+      return;
+    }
+
+  req->type    = EIO_READDIR;
+  req->pri     = stream->pri;
+  req->flags   = EIO_FLAG_STREAM;
+  req->ptr1    = stream;
+  req->int1    = stream->flags;
+  req->finish  = stream->cb;
+  req->data    = grp->data;
+  req->destroy = eio_api_destroy;
+
+  eio_grp_add (grp, req);
+  eio_submit (req);
+}
+
+static void
+eio__dirstream_destroy (eio_req *grp)
+{
+  struct eio_dirstream *stream = (struct eio_dirstream *)grp->ptr1;
+
+  if (stream->state == EIO_DIRSTREAM_OPEN)
+    eio__dirscan_close (&stream->dir);
+
+  free (stream->tmpbuf.ptr);
+  free (stream->path);
+  free (stream);
+
+  eio_api_destroy (grp);
+}
+
+eio_req *eio_readdir_stream (const char *path, int flags, int nentries, int pri, eio_cb cb, void *data)
+{
+  eio_req *grp;
+  struct eio_dirstream *stream = calloc (1, sizeof (*stream));
+
+  if (!stream)
+    return 0;
+
+  stream->path = strdup (path);
+
+  if (!stream->path)
+    {
+      free (stream);
+      return 0;
+    }
+
+  stream->flags    = flags;
+  stream->nentries = nentries > 0 ? nentries : 1;
+  stream->pri      = pri;
+  stream->cb       = cb;
+  stream->state    = EIO_DIRSTREAM_NEW;
+
+  grp = eio_grp (0, data);
+
+  if (!grp)
+    {
+      free (stream->path);
+      free (stream);
+      return 0;
+    }
+
+  grp->ptr1    = stream;
+  grp->destroy = eio__dirstream_destroy;
+
+  /* a limit of one means the next chunk is only read after the previous one was handled */
+  eio_grp_feed (grp, eio__dirstream_feed, 1);
+
+  return grp;
+}
+
+static void eio__tree_feed (eio_req *grp);
+
+/* chunks without entries are not reported, except for errors and the final chunk */
+static int
+eio__tree_finish (eio_req *req)
+{
+  eio_req *grp = req->grp;
+  struct eio_tree *tree = (struct eio_tree *)grp->ptr1;
+
+  if (req->result < 0)
+    tree->state = EIO_TREE_DONE;
+  else if (tree->state != EIO_TREE_DONE)
+    grp->feed = eio__tree_feed; /* the feeder might have given up while chunks were running */
+
+  return tree->cb && (req->result || req->int3) ? tree->cb (req) : 0;
+}
+
+static void
+eio__tree_feed (eio_req *grp)
+{
+  struct eio_tree *tree = (struct eio_tree *)grp->ptr1;
+  eio_req *req;
+  int more;
+
+  if (tree->state == EIO_TREE_DONE)
+    return;
+
+  X_LOCK (tree->lock);
+  more = tree->nstack > tree->nwaiting;
+  if (more)
+    ++tree->nwaiting;
+  X_UNLOCK (tree->lock);
+
+  /* while chunks are running, they might find more directories */
+  if (!more && grp->size)
+    return;
+
+  req = (eio_req *)calloc (1, sizeof *req);
+
+  if (!req)
+    {
+      /* not adding a request ends the stream */
+      tree->state  = EIO_TREE_DONE;
+      grp->result  = -1;
+      grp->errorno = ENOMEM;
+      return;
+    }
+
+  req->type    = tree->type;
+  req->pri     = tree->pri;
+  req->flags   = EIO_FLAG_STREAM;
+  req->ptr1    = tree;
+  req->int1    = tree->flags;
+  req->finish  = eio__tree_finish;
+  req->data    = grp->data;
+  req->destroy = eio_api_destroy;
+
+  /* no directories left and nothing running, so we are done */
+  if (!more)
+    {
+      req->int3 = 1;
+      tree->state = EIO_TREE_DONE;
+    }
+
+  eio_grp_add (grp, req);
+  eio_submit (req);
+}
+
+static void
+eio__tree_destroy (eio_req *grp)
+{
+  struct eio_tree *tree = (struct eio_tree *)grp->ptr1;
+
+  /* free the directories left over after errors or cancellation */
+  while (tree->stack)
+    {
+      struct eio_tree_node *node = tree->stack;
+
+      tree->stack = node->next;
+      eio__tree_unref (tree, node, 0);
+    }
+
+  X_MUTEX_DESTROY (tree->lock);
+  free (tree->path);
+  free (tree->dpath);
+  free (tree);
+
+  eio_api_destroy (grp);
+}
+
+static eio_req *
+eio__tree (int type, eio_wd wd, const char *path, eio_wd dwd, const char *dpath, int flags, int maxdepth, eio_treewalk_filter filter, int nentries, int nthreads, int pri, eio_cb cb, void *data)
+{
+  eio_req *grp;
+  struct eio_tree_node *root;
+  struct eio_tree *tree = calloc (1, sizeof (*tree));
+
+  if (!tree)
+    return 0;
+
+  tree->path  = strdup (path);
+  tree->dpath = dpath ? strdup (dpath) : 0;
+  root = calloc (1, sizeof (*root));
+
+  if (!tree->path || (dpath && !tree->dpath) || !root || !(grp = eio_grp (0, data)))
+    {
+      free (tree->path);
+      free (tree->dpath);
+      free (tree);
+      free (root);
+      return 0;
+    }
+
+  root->refcnt = 1;
+  root->fd     = -1;
+  root->dfd    = -1;
+  root->depth  = 1;
+
+  X_MUTEX_CREATE (tree->lock);
+  tree->stack    = root;
+  tree->nstack   = 1;
+  tree->type     = type;
+  tree->wd       = wd;
+  tree->dwd      = dwd;
+  tree->flags    = flags;
+  tree->maxdepth = maxdepth;
+  tree->nentries = nentries > 0 ? nentries : 1;
+  tree->limit    = nthreads > 0 ? nthreads : 1;
+  tree->pri      = pri;
+  tree->filter   = filter;
+  tree->cb       = cb;
+  tree->data     = data;
+  tree->state    = EIO_TREE_RUN;
+
+  grp->ptr1    = tree;
+  grp->destroy = eio__tree_destroy;
+
+  eio_grp_feed (grp, eio__tree_feed, tree->limit);
+
+  return grp;
+}
+
+eio_req *eio_treewalk (eio_wd wd, const char *path, int flags, int maxdepth, eio_treewalk_filter filter, int nentries, int nthreads, int pri, eio_cb cb, void *data)
+{
+  return eio__tree (EIO_TREEWALK, wd, path, 0, 0, flags, maxdepth, filter, nentries, nthreads, pri, cb, data);
+}
+
+eio_req *eio_rmtree (eio_wd wd, const char *path, int flags, int nentries, int nthreads, int pri, eio_cb cb, void *data)
+{
+  /* symlinks are never followed, but removed */
+  return eio__tree (EIO_RMTREE, wd, path, 0, 0, flags & EIO_TREEWALK_XDEV, 0, 0, nentries, nthreads, pri, cb, data);
+}
+
+eio_req *eio_copytree (eio_wd wd, const char *path, eio_wd dstwd, const char *dstpath, int flags, eio_treewalk_filter filter, int nentries, int nthreads, int pri, eio_cb cb, void *data)
+{
+  return eio__tree (EIO_COPYTREE, wd, path, dstwd, dstpath, flags, 0, filter, nentries, nthreads, pri, cb, data);
+}
+
+#endif
+
 #undef REQ
 #undef PATH
 #undef SEND
@@ -2440,7 +7217,7 @@ eio_grp_add (eio_req *grp, eio_req *req)
 eio_ssize_t
 eio_sendfile_sync (int ofd, int ifd, off_t offset, size_t count)
 {
-  return eio__sendfile (ofd, ifd, offset, count);
+  return eio__sendfile (ofd, ifd, offset, count, 0);
 }
 
 int eio_mlockall_sync (int flags)
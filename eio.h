@@ -51,6 +51,8 @@ extern "C" {
 typedef struct eio_req    eio_req;
 typedef struct eio_dirent eio_dirent;
 
+struct iovec;
+
 typedef int (*eio_cb)(eio_req *req);
 
 #ifndef EIO_REQ_MEMBERS
@@ -108,12 +110,32 @@ enum
   EIO_READDIR_DENTS         = 0x01, /* ptr2 contains eio_dirents, not just the (unsorted) names */
   EIO_READDIR_DIRS_FIRST    = 0x02, /* dirents gets sorted into a good stat() ing order to find directories first */
   EIO_READDIR_STAT_ORDER    = 0x04, /* dirents gets sorted into a good stat() ing order to quickly stat all files */
+  EIO_READDIR_STAT          = 0x08, /* lstat all entries, implies DENTS and STAT_ORDER, see EIO_READDIR_STAT_BUF */
+  EIO_READDIR_COMPACT       = 0x10, /* like DENTS, but as arrays stored behind the names in ptr2, see EIO_READDIR_INODE */
   EIO_READDIR_FOUND_UNKNOWN = 0x80, /* set by eio_readdir when *_ARRAY was set and any TYPE=UNKNOWN's were found */
 
   EIO_READDIR_CUSTOM1       = 0x100, /* for use by apps */
   EIO_READDIR_CUSTOM2       = 0x200  /* for use by apps */
 };
 
+/* eio_treewalk flags */
+enum
+{
+  EIO_TREEWALK_XDEV   = 0x01, /* do not descend into directories on other filesystems */
+  EIO_TREEWALK_FOLLOW = 0x02, /* descend into symlinks to directories */
+  EIO_COPYTREE_NOREFLINK = 0x04 /* eio_copytree: always copy the data, never share extents */
+};
+
+/* eio_treewalk filter return values */
+enum
+{
+  EIO_TREEWALK_SKIP  = 0x01, /* do not return this entry */
+  EIO_TREEWALK_PRUNE = 0x02  /* do not descend into this directory */
+};
+
+/* called in a worker thread for every entry found by eio_treewalk, path is relative to the start directory */
+typedef int (*eio_treewalk_filter)(const char *path, eio_dirent *ent, void *data);
+
 /* using "typical" values in the hope that the compiler will do something sensible */
 enum eio_dtype
 {
@@ -167,6 +189,31 @@ enum
   EIO_SYNC_FILE_RANGE_WAIT_AFTER  = 4
 };
 
+/* eio_fadvise advice */
+enum
+{
+  EIO_FADV_NORMAL     = 0,
+  EIO_FADV_RANDOM     = 1,
+  EIO_FADV_SEQUENTIAL = 2,
+  EIO_FADV_WILLNEED   = 3,
+  EIO_FADV_DONTNEED   = 4,
+  EIO_FADV_NOREUSE    = 5
+};
+
+/* eio_mincore flags */
+enum
+{
+  EIO_MINCORE_COUNT = 0x01 /* only count the cached pages, do not return a bitmap */
+};
+
+/* eio_set_inline flags */
+enum
+{
+  EIO_INLINE_READ = 0x01, /* eio_read with an offset, if all data is in the page cache */
+  EIO_INLINE_OPEN = 0x02, /* eio_open of files and directories, if the path is in the dentry cache */
+  EIO_INLINE_STAT = 0x04  /* eio_stat and eio_lstat, if the path is in the dentry cache */
+};
+
 /* eio_fallocate flags */
 enum
 {
@@ -188,6 +235,32 @@ enum
   EIO_RENAME_WHITEOUT  = 1 << 2
 };
 
+/* eio_readv/eio_writev flags */
+enum
+{
+  /* these MUST match the value in linux/fs.h */
+  EIO_RWF_HIPRI  = 0x01,
+  EIO_RWF_DSYNC  = 0x02,
+  EIO_RWF_SYNC   = 0x04,
+  EIO_RWF_NOWAIT = 0x08,
+  EIO_RWF_APPEND = 0x10
+};
+
+/* eio_copyfile flags */
+enum
+{
+  EIO_COPYFILE_NOREFLINK = 0x01 /* always copy the data, never share extents */
+};
+
+/* eio_slurp_mmap flags */
+enum
+{
+  EIO_SLURP_MMAP       = 0x01, /* map the file instead of reading it, always set by eio_slurp_mmap */
+  EIO_SLURP_POPULATE   = 0x02, /* prefault the mapping (MAP_POPULATE) */
+  EIO_SLURP_SEQUENTIAL = 0x04, /* madvise MADV_SEQUENTIAL */
+  EIO_SLURP_WILLNEED   = 0x08  /* madvise MADV_WILLNEED */
+};
+
 /* timestamps and differences - feel free to use double in your code directly */
 typedef double eio_tstamp;
 
@@ -198,12 +271,12 @@ enum
   EIO_WD_OPEN, EIO_WD_CLOSE,
 
   EIO_CLOSE, EIO_DUP2,
-  EIO_SEEK, EIO_READ, EIO_WRITE, EIO_FCNTL, EIO_IOCTL,
-  EIO_READAHEAD, EIO_SENDFILE,
+  EIO_SEEK, EIO_READ, EIO_WRITE, EIO_READV, EIO_WRITEV, EIO_FCNTL, EIO_IOCTL,
+  EIO_READAHEAD, EIO_FADVISE, EIO_SENDFILE, EIO_COPYFILE,
   EIO_FSTAT, EIO_FSTATVFS,
   EIO_FTRUNCATE, EIO_FUTIME, EIO_FCHMOD, EIO_FCHOWN,
   EIO_SYNC, EIO_FSYNC, EIO_FDATASYNC, EIO_SYNCFS,
-  EIO_MSYNC, EIO_MTOUCH, EIO_SYNC_FILE_RANGE, EIO_FALLOCATE,
+  EIO_MSYNC, EIO_MTOUCH, EIO_MINCORE, EIO_SYNC_FILE_RANGE, EIO_FALLOCATE,
   EIO_MLOCK, EIO_MLOCKALL,
   EIO_GROUP, EIO_NOP,
   EIO_BUSY,
@@ -211,6 +284,7 @@ enum
   /* these use wd + ptr1, but are emulated */
   EIO_REALPATH,
   EIO_READDIR,
+  EIO_TREEWALK, EIO_RMTREE, EIO_COPYTREE,
 
   /* all the following requests use wd + ptr1 as path in xxxat functions */
   EIO_OPEN,
@@ -264,16 +338,16 @@ struct eio_req
   eio_wd wd;       /* all applicable requests: working directory of pathname, old name; wd_open: return wd */
 
   eio_ssize_t result;  /* result of syscall, e.g. result = read (... */
-  off_t offs;      /* read, write, truncate, readahead, sync_file_range, fallocate, slurp: file offset, mknod: dev_t */
-  size_t size;     /* read, write, readahead, sendfile, msync, mlock, sync_file_range, fallocate, slurp: length */
+  off_t offs;      /* read, write, readv, writev, truncate, readahead, fadvise, mincore, sync_file_range, fallocate, slurp: file offset, mknod: dev_t */
+  size_t size;     /* read, write, readahead, fadvise, mincore, sendfile, msync, mlock, sync_file_range, fallocate, slurp: length */
   void *ptr1;      /* all applicable requests: pathname, old name, readdir: optional eio_dirents */
-  void *ptr2;      /* all applicable requests: new name or memory buffer; readdir: name strings */
+  void *ptr2;      /* all applicable requests: new name or memory buffer; readdir: name strings; readv, writev: iovec array */
   eio_tstamp nv1;  /* utime, futime: atime; busy: sleep time */
   eio_tstamp nv2;  /* utime, futime: mtime */
 
-  int int1;        /* all applicable requests: file descriptor; sendfile: output fd; open, msync, mlockall, readdir: flags */
-  long int2;       /* chown, fchown: uid; sendfile: input fd; open, chmod, mkdir, mknod: file mode, seek: whence, fcntl, ioctl: request, sync_file_range, fallocate, rename: flags */
-  long int3;       /* chown, fchown: gid; rename, link: working directory of new name */
+  int int1;        /* all applicable requests: file descriptor; sendfile, copyfile: output fd; open, msync, mlockall, readdir, slurp: flags */
+  long int2;       /* chown, fchown: uid; sendfile, copyfile: input fd; slurp: offset of ptr2 in its mapping; read: device of fd; readv, writev: iovcnt; open, chmod, mkdir, mknod: file mode, seek: whence, fcntl, ioctl: request, sync_file_range, fallocate, rename, mincore: flags; fadvise: advice */
+  long int3;       /* chown, fchown: gid; read: inode of fd; copyfile, readv, writev: flags; rename, link: working directory of new name */
   int errorno;     /* errno value on syscall return */
 
   unsigned char flags; /* private */
@@ -300,6 +374,10 @@ struct eio_req
 enum {
   EIO_FLAG_PTR1_FREE = 0x01, /* need to free(ptr1) */
   EIO_FLAG_PTR2_FREE = 0x02, /* need to free(ptr2) */
+  EIO_FLAG_STREAM    = 0x10, /* request is a chunk of a stream, ptr1 points to the stream state */
+  EIO_FLAG_MUNMAP    = 0x20, /* need to munmap(ptr2 - int2, size + int2) */
+  EIO_FLAG_COALESCED = 0x40, /* read or write executed together with requests chained to next */
+  EIO_FLAG_FILEID    = 0x80, /* read: int2 and int3 are device and inode of the fd, or 0 */
 };
 
 /* undocumented/unsupported/private helper */
@@ -329,6 +407,49 @@ void eio_set_max_parallel (unsigned int nthreads);
 void eio_set_max_idle     (unsigned int nthreads);
 void eio_set_idle_timeout (unsigned int seconds);
 
+/* per-worker scratch buffers: release them after being idle for seconds, */
+/* or after a request when all of them together use more than bytes (0 means no limit) */
+void eio_set_tmpbuf_timeout (unsigned int seconds);
+void eio_set_max_tmpbuf (size_t bytes);
+/* stores the scratch buffer sizes of up to n workers in sizes, returns the total size */
+size_t eio_tmpbuf_stats (size_t *sizes, unsigned int n);
+
+/* split reads, writes and slurps larger than two chunks into chunks handled by idle workers, 0 disables */
+void eio_set_io_chunk_size (size_t bytes);
+
+/* merge up to nreqs queued writes to adjacent ranges of the same fd into one, < 2 disables */
+void eio_set_max_write_coalesce (unsigned int nreqs);
+
+/* serve queued reads of the same file that overlap or touch with one read of up to bytes, 0 disables */
+void eio_set_max_read_coalesce (size_t bytes);
+
+/* issue readahead for sequential eio_read streams, in windows growing up to bytes, 0 disables */
+void eio_set_max_readahead_window (size_t bytes);
+
+/* drop what requests read from or wrote to fd from the page cache, returns -1 on error */
+int eio_set_drop_behind (int fd, int enable);
+
+/* percentage of the pages of a finished eio_mincore request that are cached */
+double eio_mincore_percent (const eio_req *req);
+
+/* execute requests that would not block in the submitting thread, EIO_INLINE_* flags */
+void eio_set_inline (int flags);
+
+/* cache up to entries eio_stat/eio_lstat results, invalidated by inotify or after ttl seconds, 0 disables */
+void eio_set_stat_cache (unsigned int entries, eio_tstamp ttl);
+
+/* cache up to entries symlink lookups of eio_realpath and eio_wd_open for ttl seconds, 0 disables */
+void eio_set_path_cache (unsigned int entries, eio_tstamp ttl);
+
+/* keep up to nfds directory fds for requests on absolute paths, for ttl seconds, 0 disables */
+void eio_set_dir_cache (unsigned int nfds, eio_tstamp ttl);
+
+/* expire the path and directory caches, e.g. after renaming or removing paths without eio */
+void eio_invalidate_path_cache (void);
+
+/* maximum number of files eio_copytree copies to the same device at the same time, 0 means no limit */
+void eio_set_max_device_copies (unsigned int ncopies);
+
 unsigned int eio_nreqs    (void); /* number of requests in-flight */
 unsigned int eio_nready   (void); /* number of not-yet handled requests */
 unsigned int eio_npending (void); /* number of finished but unhandled requests */
@@ -349,15 +470,19 @@ eio_req *eio_fdatasync (int fd, int pri, eio_cb cb, void *data);
 eio_req *eio_syncfs    (int fd, int pri, eio_cb cb, void *data);
 eio_req *eio_msync     (void *addr, size_t length, int flags, int pri, eio_cb cb, void *data);
 eio_req *eio_mtouch    (void *addr, size_t length, int flags, int pri, eio_cb cb, void *data);
+eio_req *eio_mincore   (int fd, off_t offset, size_t length, int flags, int pri, eio_cb cb, void *data); /* bitmap=ptr2 allocated dynamically */
 eio_req *eio_mlock     (void *addr, size_t length, int pri, eio_cb cb, void *data);
 eio_req *eio_mlockall  (int flags, int pri, eio_cb cb, void *data);
 eio_req *eio_sync_file_range (int fd, off_t offset, size_t nbytes, unsigned int flags, int pri, eio_cb cb, void *data);
 eio_req *eio_fallocate (int fd, int mode, off_t offset, size_t len, int pri, eio_cb cb, void *data);
 eio_req *eio_close     (int fd, int pri, eio_cb cb, void *data);
 eio_req *eio_readahead (int fd, off_t offset, size_t length, int pri, eio_cb cb, void *data);
+eio_req *eio_fadvise   (int fd, off_t offset, size_t length, int advice, int pri, eio_cb cb, void *data);
 eio_req *eio_seek      (int fd, off_t offset, int whence, int pri, eio_cb cb, void *data);
 eio_req *eio_read      (int fd, void *buf, size_t length, off_t offset, int pri, eio_cb cb, void *data);
 eio_req *eio_write     (int fd, void *buf, size_t length, off_t offset, int pri, eio_cb cb, void *data);
+eio_req *eio_readv     (int fd, const struct iovec *iov, int iovcnt, off_t offset, int flags, int pri, eio_cb cb, void *data); /* iov must stay valid until the request finishes */
+eio_req *eio_writev    (int fd, const struct iovec *iov, int iovcnt, off_t offset, int flags, int pri, eio_cb cb, void *data);
 eio_req *eio_fcntl     (int fd, int cmd, void *arg, int pri, eio_cb cb, void *data);
 eio_req *eio_ioctl     (int fd, unsigned long request, void *buf, int pri, eio_cb cb, void *data);
 eio_req *eio_fstat     (int fd, int pri, eio_cb cb, void *data); /* stat buffer=ptr2 allocated dynamically */
@@ -368,6 +493,7 @@ eio_req *eio_fchmod    (int fd, mode_t mode, int pri, eio_cb cb, void *data);
 eio_req *eio_fchown    (int fd, eio_uid_t uid, eio_gid_t gid, int pri, eio_cb cb, void *data);
 eio_req *eio_dup2      (int fd, int fd2, int pri, eio_cb cb, void *data);
 eio_req *eio_sendfile  (int out_fd, int in_fd, off_t in_offset, size_t length, int pri, eio_cb cb, void *data);
+eio_req *eio_copyfile  (int out_fd, int in_fd, int flags, int pri, eio_cb cb, void *data); /* result=number of bytes in the copy */
 eio_req *eio_open      (const char *path, int flags, mode_t mode, int pri, eio_cb cb, void *data);
 eio_req *eio_utime     (const char *path, eio_tstamp atime, eio_tstamp mtime, int pri, eio_cb cb, void *data);
 eio_req *eio_truncate  (const char *path, off_t offset, int pri, eio_cb cb, void *data);
@@ -375,6 +501,11 @@ eio_req *eio_chown     (const char *path, eio_uid_t uid, eio_gid_t gid, int pri,
 eio_req *eio_chmod     (const char *path, mode_t mode, int pri, eio_cb cb, void *data);
 eio_req *eio_mkdir     (const char *path, mode_t mode, int pri, eio_cb cb, void *data);
 eio_req *eio_readdir   (const char *path, int flags, int pri, eio_cb cb, void *data); /* result=ptr2 allocated dynamically */
+eio_req *eio_readdirplus (const char *path, int flags, int nthreads, int pri, eio_cb cb, void *data); /* readdir with EIO_READDIR_STAT, using up to nthreads workers */
+eio_req *eio_readdir_stream (const char *path, int flags, int nentries, int pri, eio_cb cb, void *data); /* returns a group, cb is called once per chunk */
+eio_req *eio_treewalk  (eio_wd wd, const char *path, int flags, int maxdepth, eio_treewalk_filter filter, int nentries, int nthreads, int pri, eio_cb cb, void *data); /* returns a group, cb is called once per chunk */
+eio_req *eio_rmtree    (eio_wd wd, const char *path, int flags, int nentries, int nthreads, int pri, eio_cb cb, void *data); /* returns a group, cb is called with the number of entries removed */
+eio_req *eio_copytree  (eio_wd wd, const char *path, eio_wd dstwd, const char *dstpath, int flags, eio_treewalk_filter filter, int nentries, int nthreads, int pri, eio_cb cb, void *data); /* returns a group, cb is called with the number of entries and (in offs) bytes copied */
 eio_req *eio_rmdir     (const char *path, int pri, eio_cb cb, void *data);
 eio_req *eio_unlink    (const char *path, int pri, eio_cb cb, void *data);
 eio_req *eio_readlink  (const char *path, int pri, eio_cb cb, void *data); /* result=ptr2 allocated dynamically */
@@ -387,6 +518,7 @@ eio_req *eio_link      (const char *path, const char *new_path, int pri, eio_cb
 eio_req *eio_symlink   (const char *path, const char *new_path, int pri, eio_cb cb, void *data);
 eio_req *eio_rename    (const char *path, const char *new_path, int pri, eio_cb cb, void *data);
 eio_req *eio_slurp     (const char *path, void *buf, size_t length, off_t offset, int pri, eio_cb cb, void *data);
+eio_req *eio_slurp_mmap (const char *path, size_t length, off_t offset, int flags, int pri, eio_cb cb, void *data); /* mapping=ptr2 unmapped automatically */
 eio_req *eio_custom    (void (*execute)(eio_req *), int pri, eio_cb cb, void *data);
 #endif
 
@@ -412,6 +544,13 @@ void eio_grp_cancel    (eio_req *grp); /* cancels all sub requests but not the g
 #define EIO_STATVFS_BUF(req) ((EIO_STRUCT_STATVFS *)EIO_BUF(req))
 #define EIO_PATH(req)        ((char *)(req)->ptr1)
 
+/* for readdir with EIO_READDIR_STAT, an array of stat buffers, one per entry */
+#define EIO_READDIR_STAT_BUF(req) ((EIO_STRUCT_STAT *)((char *)(req)->ptr1 + (req)->offs))
+/* for readdir with EIO_READDIR_COMPACT, arrays with one element per entry */
+#define EIO_READDIR_INODE(req)    ((eio_ino_t *)(req)->ptr1)
+#define EIO_READDIR_NAMEOFS(req)  ((int *)(EIO_READDIR_INODE (req) + (req)->result))
+#define EIO_READDIR_TYPE(req)     ((unsigned char *)(EIO_READDIR_NAMEOFS (req) + (req)->result))
+
 /* submit a request for execution */
 void eio_submit (eio_req *req);
 /* cancel a request as soon fast as possible, if possible */
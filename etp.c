@@ -63,6 +63,10 @@
 # define ETP_TYPE_GROUP 1
 #endif
 
+#ifndef ETP_TYPE_HELPER
+# define ETP_TYPE_HELPER (ETP_TYPE_QUIT - 1)
+#endif
+
 #ifndef ETP_WANT_POLL
 # define ETP_WANT_POLL(pool) pool->want_poll_cb (pool->userdata)
 #endif
@@ -70,6 +74,19 @@
 # define ETP_DONE_POLL(pool) pool->done_poll_cb (pool->userdata)
 #endif
 
+/* called with reqlock held for every dequeued request, can take more requests */
+/* with etp_reqq_take and chain them to req->next, to be completed after req, */
+/* returns non-zero when req itself will be completed with another request */
+#ifndef ETP_COALESCE
+# define ETP_COALESCE(pool,req) 0
+#endif
+
+/* called by etp_submit, can execute req in the submitting thread, returns */
+/* non-zero if it did, in which case req goes straight to the result queue */
+#ifndef ETP_INLINE
+# define ETP_INLINE(pool,req) 0
+#endif
+
 #define ETP_NUM_PRI (ETP_PRI_MAX - ETP_PRI_MIN + 1)
 
 #define ETP_TICKS ((1000000 + 1023) >> 10)
@@ -93,13 +110,30 @@ struct etp_tmpbuf
   int len;
 };
 
+/* smallest size class of scratch buffers, all others are powers of two */
+#ifndef ETP_TMPBUF_MIN
+# define ETP_TMPBUF_MIN 4096
+#endif
+
 static void *
 etp_tmpbuf_get (struct etp_tmpbuf *buf, int len)
 {
   if (buf->len < len)
     {
+      /* round up to the next size class, so slowly growing users do not reallocate every time */
+      int size = ETP_TMPBUF_MIN;
+
+      while (size < len && size <= INT_MAX / 2)
+        size <<= 1;
+
+      if (size < len)
+        size = len;
+
       free (buf->ptr);
-      buf->ptr = malloc (buf->len = len);
+      buf->ptr = malloc (buf->len = size);
+
+      if (!buf->ptr)
+        buf->len = 0;
     }
 
   return buf->ptr;
@@ -123,6 +157,7 @@ typedef struct etp_worker
   etp_pool pool;
 
   struct etp_tmpbuf tmpbuf;
+  int tmpbuf_size; /* tmpbuf.len as accounted in pool->tmpbuf_total, locked by pool->reslock */
 
   /* locked by pool->wrklock */
   struct etp_worker *prev, *next;
@@ -151,6 +186,10 @@ struct etp_pool
    unsigned int npending; /* pool->reqlock */
    unsigned int max_idle;      /* maximum number of threads that can pool->idle indefinitely */
    unsigned int idle_timeout; /* number of seconds after which an pool->idle threads exit */
+   unsigned int tmpbuf_timeout; /* number of seconds after which idle threads release their scratch buffer, pool->reqlock */
+
+   size_t tmpbuf_total; /* scratch memory of all workers, pool->reslock */
+   size_t max_tmpbuf;   /* release scratch buffers when tmpbuf_total exceeds this, pool->reslock */
 
    void (*want_poll_cb) (void *userdata);
    void (*done_poll_cb) (void *userdata);
@@ -168,16 +207,44 @@ struct etp_pool
 
 /* worker threads management */
 
+/* release the scratch buffer of a worker, pool->reslock must be held */
+static void
+etp_worker_trim (etp_worker *wrk)
+{
+  wrk->pool->tmpbuf_total -= wrk->tmpbuf_size;
+  wrk->tmpbuf_size = 0;
+
+  free (wrk->tmpbuf.ptr);
+  wrk->tmpbuf.ptr = 0;
+  wrk->tmpbuf.len = 0;
+}
+
+/* called after each request, with pool->reslock held */
 static void
 etp_worker_clear (etp_worker *wrk)
 {
+  etp_pool pool = wrk->pool;
+
+  pool->tmpbuf_total += wrk->tmpbuf.len - wrk->tmpbuf_size;
+  wrk->tmpbuf_size = wrk->tmpbuf.len;
+
+  if (pool->max_tmpbuf && pool->tmpbuf_total > pool->max_tmpbuf)
+    etp_worker_trim (wrk);
 }
 
 static void ecb_cold
 etp_worker_free (etp_worker *wrk)
 {
+  X_LOCK (wrk->pool->reslock);
+  wrk->pool->tmpbuf_total -= wrk->tmpbuf_size;
+  X_UNLOCK (wrk->pool->reslock);
+
   free (wrk->tmpbuf.ptr);
 
+#ifdef ETP_WORKER_FREE
+  ETP_WORKER_FREE (wrk);
+#endif
+
   wrk->next->prev = wrk->prev;
   wrk->prev->next = wrk->next;
 
@@ -284,6 +351,26 @@ reqq_shift (etp_reqq *q)
   abort ();
 }
 
+/* remove req, which follows prev (or comes first if prev is 0) in its */
+/* priority queue, from the request queue, pool->reqlock must be held */
+static void ecb_noinline
+etp_reqq_take (etp_pool pool, ETP_REQ *prev, ETP_REQ *req)
+{
+  etp_reqq *q = &pool->req_queue;
+  int pri = req->pri;
+
+  if (prev)
+    prev->next = req->next;
+  else
+    q->qs[pri] = (ETP_REQ *)req->next;
+
+  if (q->qe[pri] == req)
+    q->qe[pri] = prev;
+
+  --q->size;
+  --pool->nready;
+}
+
 ETP_API_DECL int ecb_cold
 etp_init (etp_pool pool, void *userdata, void (*want_poll)(void *userdata), void (*done_poll)(void *userdata))
 {
@@ -307,6 +394,10 @@ etp_init (etp_pool pool, void *userdata, void (*want_poll)(void *userdata), void
 
   pool->max_idle = 4;      /* maximum number of threads that can pool->idle indefinitely */
   pool->idle_timeout = 10; /* number of seconds after which an pool->idle threads exit */
+  pool->tmpbuf_timeout = 5;
+
+  pool->tmpbuf_total = 0;
+  pool->max_tmpbuf   = 0;
 
   pool->userdata     = userdata;
   pool->want_poll_cb = want_poll;
@@ -332,6 +423,61 @@ etp_proc_init (void)
 #endif
 }
 
+/* fan-out: lets a request spread its work over otherwise idle workers */
+/* the work function must claim work items itself, and return when none are left */
+typedef struct etp_fanout
+{
+  xmutex_t lock;
+  xcond_t wait;
+  int refcnt; /* owner + queued helpers */
+  int active; /* helpers currently inside work */
+  int done;   /* owner has returned, work and arg are gone */
+  void (*work)(etp_worker *self, void *arg);
+  void *arg;
+} etp_fanout;
+
+typedef struct
+{
+  ETP_REQ req; /* must be first */
+  etp_fanout *fanout;
+} etp_helper;
+
+static void
+etp_fanout_unref (etp_fanout *fanout)
+{
+  int last = !--fanout->refcnt;
+
+  X_UNLOCK (fanout->lock);
+
+  if (last)
+    {
+      X_COND_DESTROY (fanout->wait);
+      X_MUTEX_DESTROY (fanout->lock);
+      free (fanout);
+    }
+}
+
+static void
+etp_fanout_help (etp_worker *self, etp_fanout *fanout)
+{
+  X_LOCK (fanout->lock);
+
+  if (!fanout->done)
+    {
+      ++fanout->active;
+      X_UNLOCK (fanout->lock);
+
+      fanout->work (self, fanout->arg);
+
+      X_LOCK (fanout->lock);
+
+      if (!--fanout->active)
+        X_COND_SIGNAL (fanout->wait);
+    }
+
+  etp_fanout_unref (fanout);
+}
+
 X_THREAD_PROC (etp_proc)
 {
   ETP_REQ *req;
@@ -352,6 +498,8 @@ X_THREAD_PROC (etp_proc)
 
       for (;;)
         {
+          int trim = 0;
+
           req = reqq_shift (&pool->req_queue);
 
           if (ecb_expect_true (req))
@@ -369,8 +517,22 @@ X_THREAD_PROC (etp_proc)
           ++pool->idle;
 
           if (pool->idle <= pool->max_idle)
-            /* we are allowed to pool->idle, so do so without any timeout */
-            X_COND_WAIT (pool->reqwait, pool->reqlock);
+            {
+              /* we are allowed to pool->idle, so do so without any timeout, */
+              /* except to release our scratch buffer when idle for a while */
+              if (self->tmpbuf.ptr && pool->tmpbuf_timeout)
+                {
+                  struct timespec tts;
+
+                  tts.tv_sec  = time (0) + pool->tmpbuf_timeout;
+                  tts.tv_nsec = ts.tv_nsec;
+
+                  if (X_COND_TIMEDWAIT (pool->reqwait, pool->reqlock, tts) == ETIMEDOUT)
+                    trim = 1;
+                }
+              else
+                X_COND_WAIT (pool->reqwait, pool->reqlock);
+            }
           else
             {
               /* initialise timeout once */
@@ -382,23 +544,60 @@ X_THREAD_PROC (etp_proc)
             }
 
           --pool->idle;
+
+          if (trim)
+            {
+              X_UNLOCK (pool->reqlock);
+              X_LOCK (pool->reslock);
+              etp_worker_trim (self);
+              X_UNLOCK (pool->reslock);
+              X_LOCK (pool->reqlock);
+            }
         }
 
       --pool->nready;
 
+      req->next = 0;
+
+      if (ecb_expect_false (ETP_COALESCE (pool, req)))
+        {
+          X_UNLOCK (pool->reqlock);
+          continue;
+        }
+
       X_UNLOCK (pool->reqlock);
      
       if (ecb_expect_false (req->type == ETP_TYPE_QUIT))
         goto quit;
 
+      if (ecb_expect_false (req->type == ETP_TYPE_HELPER))
+        {
+          etp_fanout_help (self, ((etp_helper *)req)->fanout);
+          free (req);
+
+          X_LOCK (pool->reslock);
+          etp_worker_clear (self);
+          X_UNLOCK (pool->reslock);
+
+          continue;
+        }
+
       ETP_EXECUTE (self, req);
 
       X_LOCK (pool->reslock);
 
-      ++pool->npending;
+      do
+        {
+          ETP_REQ *next = (ETP_REQ *)req->next;
 
-      if (!reqq_push (&pool->res_queue, req))
-        ETP_WANT_POLL (pool);
+          ++pool->npending;
+
+          if (!reqq_push (&pool->res_queue, req))
+            ETP_WANT_POLL (pool);
+
+          req = next;
+        }
+      while (req);
 
       etp_worker_clear (self);
 
@@ -454,6 +653,91 @@ etp_maybe_start_thread (etp_pool pool)
   etp_start_thread (pool);
 }
 
+/* run work (self, arg) in the calling worker, and in up to nhelpers */
+/* additional idle (or newly started) workers, returning when all are done */
+static void
+etp_fanout_run (etp_pool pool, etp_worker *self, int nhelpers, int pri,
+                void (*work)(etp_worker *self, void *arg), void *arg)
+{
+  etp_fanout *fanout = 0;
+  int avail, start;
+
+  if (nhelpers > 0)
+    {
+      /* only use threads that would otherwise do nothing */
+
+      X_LOCK (pool->reqlock);
+      avail = (int)pool->idle - (int)pool->nready;
+      X_UNLOCK (pool->reqlock);
+
+      X_LOCK (pool->wrklock);
+      start = (int)pool->wanted - (int)pool->started;
+      X_UNLOCK (pool->wrklock);
+
+      if (avail < 0) avail = 0;
+      if (start < 0) start = 0;
+
+      if (nhelpers > avail + start)
+        nhelpers = avail + start;
+
+      start = nhelpers - avail;
+
+      if (nhelpers > 0)
+        fanout = malloc (sizeof (etp_fanout));
+    }
+
+  if (fanout)
+    {
+      X_MUTEX_CREATE (fanout->lock);
+      X_COND_CREATE (fanout->wait);
+      fanout->refcnt = 1;
+      fanout->active = 0;
+      fanout->done   = 0;
+      fanout->work   = work;
+      fanout->arg    = arg;
+
+      while (nhelpers--)
+        {
+          etp_helper *helper = calloc (1, sizeof (etp_helper));
+
+          if (!helper)
+            break;
+
+          helper->req.type = ETP_TYPE_HELPER;
+          helper->req.pri  = pri;
+          helper->fanout   = fanout;
+
+          X_LOCK (fanout->lock);
+          ++fanout->refcnt;
+          X_UNLOCK (fanout->lock);
+
+          X_LOCK (pool->reqlock);
+          ++pool->nready;
+          reqq_push (&pool->req_queue, &helper->req);
+          X_COND_SIGNAL (pool->reqwait);
+          X_UNLOCK (pool->reqlock);
+        }
+
+      while (start-- > 0)
+        etp_start_thread (pool);
+    }
+
+  work (self, arg);
+
+  if (fanout)
+    {
+      X_LOCK (fanout->lock);
+
+      while (fanout->active)
+        X_COND_WAIT (fanout->wait, fanout->lock);
+
+      /* helpers that did not start yet will find nothing to do */
+      fanout->done = 1;
+
+      etp_fanout_unref (fanout);
+    }
+}
+
 static void ecb_cold
 etp_end_thread (etp_pool pool)
 {
@@ -567,7 +851,7 @@ etp_submit (etp_pool pool, ETP_REQ *req)
   if (ecb_expect_false (req->pri < ETP_PRI_MIN - ETP_PRI_MIN)) req->pri = ETP_PRI_MIN - ETP_PRI_MIN;
   if (ecb_expect_false (req->pri > ETP_PRI_MAX - ETP_PRI_MIN)) req->pri = ETP_PRI_MAX - ETP_PRI_MIN;
 
-  if (ecb_expect_false (req->type == ETP_TYPE_GROUP))
+  if (ecb_expect_false (req->type == ETP_TYPE_GROUP) || ETP_INLINE (pool, req))
     {
       /* I hope this is worth it :/ */
       X_LOCK (pool->reqlock);
@@ -628,6 +912,43 @@ etp_set_idle_timeout (etp_pool pool, unsigned int seconds)
   if (WORDACCESS_UNSAFE) X_UNLOCK (pool->reqlock);
 }
 
+ETP_API_DECL void ecb_cold
+etp_set_tmpbuf_timeout (etp_pool pool, unsigned int seconds)
+{
+  if (WORDACCESS_UNSAFE) X_LOCK   (pool->reqlock);
+  pool->tmpbuf_timeout = seconds;
+  if (WORDACCESS_UNSAFE) X_UNLOCK (pool->reqlock);
+}
+
+ETP_API_DECL void ecb_cold
+etp_set_max_tmpbuf (etp_pool pool, size_t bytes)
+{
+  X_LOCK   (pool->reslock);
+  pool->max_tmpbuf = bytes;
+  X_UNLOCK (pool->reslock);
+}
+
+/* store the scratch buffer sizes of up to n workers in sizes, returns the total */
+ETP_API_DECL size_t
+etp_tmpbuf_stats (etp_pool pool, size_t *sizes, unsigned int n)
+{
+  etp_worker *wrk;
+  size_t total;
+
+  X_LOCK (pool->wrklock);
+  X_LOCK (pool->reslock);
+
+  for (wrk = pool->wrk_first.next; wrk != &pool->wrk_first && n; wrk = wrk->next, --n)
+    *sizes++ = wrk->tmpbuf_size;
+
+  total = pool->tmpbuf_total;
+
+  X_UNLOCK (pool->reslock);
+  X_UNLOCK (pool->wrklock);
+
+  return total;
+}
+
 ETP_API_DECL void ecb_cold
 etp_set_min_parallel (etp_pool pool, unsigned int threads)
 {
@@ -93,6 +93,79 @@ int main (void)
 ])],ac_cv_sendfile=yes,ac_cv_sendfile=no)])
 test $ac_cv_sendfile = yes && AC_DEFINE(HAVE_SENDFILE, 1, sendfile(2) is available and supported)
 
+AC_CACHE_CHECK(for copy_file_range, ac_cv_copy_file_range, [AC_LINK_IFELSE([AC_LANG_SOURCE([[
+#include <sys/types.h>
+#include <unistd.h>
+int main (void)
+{
+   int fd = 0;
+   off_t offset = 1;
+   size_t count = 2;
+   ssize_t res;
+   res = copy_file_range (fd, &offset, fd, &offset, count, 0);
+   return 0;
+}
+]])],ac_cv_copy_file_range=yes,ac_cv_copy_file_range=no)])
+test $ac_cv_copy_file_range = yes && AC_DEFINE(HAVE_COPY_FILE_RANGE, 1, copy_file_range(2) is available)
+
+AC_CACHE_CHECK(for splice, ac_cv_splice, [AC_LINK_IFELSE([AC_LANG_SOURCE([[
+#include <sys/types.h>
+#include <fcntl.h>
+int main (void)
+{
+   int fd = 0;
+   loff_t offset = 1;
+   size_t count = 2;
+   ssize_t res;
+   res = splice (fd, &offset, fd, 0, count, SPLICE_F_MOVE | SPLICE_F_MORE);
+   return 0;
+}
+]])],ac_cv_splice=yes,ac_cv_splice=no)])
+test $ac_cv_splice = yes && AC_DEFINE(HAVE_SPLICE, 1, splice(2) is available (linux))
+
+AC_CACHE_CHECK(for preadv and pwritev, ac_cv_preadv, [AC_LINK_IFELSE([AC_LANG_SOURCE([[
+#include <sys/types.h>
+#include <sys/uio.h>
+int main (void)
+{
+   int fd = 0;
+   struct iovec iov [1];
+   ssize_t res;
+   res = preadv (fd, iov, 1, 0);
+   res = pwritev (fd, iov, 1, 0);
+   return 0;
+}
+]])],ac_cv_preadv=yes,ac_cv_preadv=no)])
+test $ac_cv_preadv = yes && AC_DEFINE(HAVE_PREADV, 1, preadv(2) and pwritev(2) are available)
+
+AC_CACHE_CHECK(for preadv2 and pwritev2, ac_cv_preadv2, [AC_LINK_IFELSE([AC_LANG_SOURCE([[
+#include <sys/types.h>
+#include <sys/uio.h>
+int main (void)
+{
+   int fd = 0;
+   struct iovec iov [1];
+   ssize_t res;
+   res = preadv2 (fd, iov, 1, 0, RWF_NOWAIT);
+   res = pwritev2 (fd, iov, 1, 0, RWF_DSYNC);
+   return 0;
+}
+]])],ac_cv_preadv2=yes,ac_cv_preadv2=no)])
+test $ac_cv_preadv2 = yes && AC_DEFINE(HAVE_PREADV2, 1, preadv2(2) and pwritev2(2) are available (linux))
+
+AC_CACHE_CHECK(for FICLONE, ac_cv_ficlone, [AC_LINK_IFELSE([AC_LANG_SOURCE([[
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+int main (void)
+{
+   int fd = 0;
+   int res;
+   res = ioctl (fd, FICLONE, fd);
+   return 0;
+}
+]])],ac_cv_ficlone=yes,ac_cv_ficlone=no)])
+test $ac_cv_ficlone = yes && AC_DEFINE(HAVE_FICLONE, 1, ioctl FICLONE is available (linux))
+
 AC_CACHE_CHECK(for sync_file_range, ac_cv_sync_file_range, [AC_LINK_IFELSE([AC_LANG_SOURCE([
 #include <sys/types.h>
 #include <fcntl.h>
@@ -109,6 +182,30 @@ int main (void)
 ])],ac_cv_sync_file_range=yes,ac_cv_sync_file_range=no)])
 test $ac_cv_sync_file_range = yes && AC_DEFINE(HAVE_SYNC_FILE_RANGE, 1, sync_file_range(2) is available)
 
+AC_CACHE_CHECK(for mincore, ac_cv_mincore, [AC_LINK_IFELSE([AC_LANG_SOURCE([[
+#include <sys/types.h>
+#include <sys/mman.h>
+int res;
+char vec[1];
+int main (void)
+{
+   res = mincore ((void *)0, 1, (void *)vec);
+   return 0;
+}
+]])],ac_cv_mincore=yes,ac_cv_mincore=no)])
+test $ac_cv_mincore = yes && AC_DEFINE(HAVE_MINCORE, 1, mincore(2) is available)
+
+AC_CACHE_CHECK(for posix_fadvise, ac_cv_posix_fadvise, [AC_LINK_IFELSE([AC_LANG_SOURCE([[
+#include <fcntl.h>
+int res;
+int main (void)
+{
+   res = posix_fadvise (0, 0, 0, POSIX_FADV_WILLNEED);
+   return 0;
+}
+]])],ac_cv_posix_fadvise=yes,ac_cv_posix_fadvise=no)])
+test $ac_cv_posix_fadvise = yes && AC_DEFINE(HAVE_POSIX_FADVISE, 1, posix_fadvise(2) is available)
+
 AC_CACHE_CHECK(for fallocate, ac_cv_linux_fallocate, [AC_LINK_IFELSE([AC_LANG_SOURCE([
 #include <fcntl.h>
 int main (void)
@@ -134,6 +231,17 @@ int main (void)
 ])],ac_cv_sys_syncfs=yes,ac_cv_sys_syncfs=no)])
 test $ac_cv_sys_syncfs = yes && AC_DEFINE(HAVE_SYS_SYNCFS, 1, syscall(__NR_syncfs) is available)
 
+AC_CACHE_CHECK(for getdents64, ac_cv_getdents64, [AC_LINK_IFELSE([AC_LANG_SOURCE([[
+#include <unistd.h>
+#include <sys/syscall.h>
+char buf [4096];
+int main (void)
+{
+  int res = syscall (SYS_getdents64, (int)0, buf, sizeof (buf));
+}
+]])],ac_cv_getdents64=yes,ac_cv_getdents64=no)])
+test $ac_cv_getdents64 = yes && AC_DEFINE(HAVE_GETDENTS64, 1, syscall(SYS_getdents64) is available)
+
 AC_CACHE_CHECK(for prctl_set_name, ac_cv_prctl_set_name, [AC_LINK_IFELSE([AC_LANG_SOURCE([
 #include <sys/prctl.h>
 int main (void)
@@ -155,6 +263,45 @@ int main (void)
 ]])],ac_cv_posix_close=yes,ac_cv_posix_close=no)])
 test $ac_cv_posix_close = yes && AC_DEFINE(HAVE_POSIX_CLOSE, 1, posix_close(2) is available)
 
+AC_CACHE_CHECK(for openat2, ac_cv_openat2, [AC_LINK_IFELSE([AC_LANG_SOURCE([[
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/openat2.h>
+int res;
+int main (void)
+{
+   struct open_how how = { 0, 0, RESOLVE_CACHED };
+   res = syscall (SYS_openat2, 0, "", &how, sizeof (how));
+   return 0;
+}
+]])],ac_cv_openat2=yes,ac_cv_openat2=no)])
+test $ac_cv_openat2 = yes && AC_DEFINE(HAVE_OPENAT2, 1, openat2(2) with RESOLVE_CACHED is available (linux))
+
+AC_CACHE_CHECK(for statx, ac_cv_statx, [AC_LINK_IFELSE([AC_LANG_SOURCE([[
+#include <fcntl.h>
+#include <sys/stat.h>
+struct statx stx;
+int res;
+int main (void)
+{
+   res = statx (0, "", AT_EMPTY_PATH | AT_STATX_DONT_SYNC, 0, &stx);
+   return 0;
+}
+]])],ac_cv_statx=yes,ac_cv_statx=no)])
+test $ac_cv_statx = yes && AC_DEFINE(HAVE_STATX, 1, statx(2) is available (linux))
+
+AC_CACHE_CHECK(for inotify, ac_cv_inotify, [AC_LINK_IFELSE([AC_LANG_SOURCE([[
+#include <sys/inotify.h>
+int res;
+int main (void)
+{
+   res = inotify_init1 (IN_CLOEXEC);
+   res = inotify_add_watch (res, "", IN_ATTRIB | IN_ONLYDIR);
+   return 0;
+}
+]])],ac_cv_inotify=yes,ac_cv_inotify=no)])
+test $ac_cv_inotify = yes && AC_DEFINE(HAVE_INOTIFY, 1, inotify_init1(2) is available (linux))
+
 AC_CACHE_CHECK(for renameat2, ac_cv_renameat2, [AC_LINK_IFELSE([AC_LANG_SOURCE([[
 #include <unistd.h>
 #include <sys/syscall.h>
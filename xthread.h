@@ -48,13 +48,16 @@ typedef pthread_mutex_t xmutex_t;
 #define X_MUTEX_CREATE(mutex)  pthread_mutex_init (&(mutex), 0)
 #define X_LOCK(mutex)          pthread_mutex_lock (&(mutex))
 #define X_UNLOCK(mutex)        pthread_mutex_unlock (&(mutex))
+#define X_MUTEX_DESTROY(mutex) pthread_mutex_destroy (&(mutex))
 
 typedef pthread_cond_t xcond_t;
 #define X_COND_INIT                     PTHREAD_COND_INITIALIZER
 #define X_COND_CREATE(cond)		pthread_cond_init (&(cond), 0)
 #define X_COND_SIGNAL(cond)             pthread_cond_signal (&(cond))
+#define X_COND_BROADCAST(cond)          pthread_cond_broadcast (&(cond))
 #define X_COND_WAIT(cond,mutex)         pthread_cond_wait (&(cond), &(mutex))
 #define X_COND_TIMEDWAIT(cond,mutex,to) pthread_cond_timedwait (&(cond), &(mutex), &(to))
+#define X_COND_DESTROY(cond)            pthread_cond_destroy (&(cond))
 
 typedef pthread_t xthread_t;
 #define X_THREAD_PROC(name) static void *name (void *thr_arg)
@@ -127,13 +130,16 @@ typedef pthread_mutex_t xmutex_t;
 #endif
 #define X_LOCK(mutex)		pthread_mutex_lock   (&(mutex))
 #define X_UNLOCK(mutex)		pthread_mutex_unlock (&(mutex))
+#define X_MUTEX_DESTROY(mutex)	pthread_mutex_destroy (&(mutex))
 
 typedef pthread_cond_t xcond_t;
 #define X_COND_INIT			PTHREAD_COND_INITIALIZER
 #define X_COND_CREATE(cond)		pthread_cond_init (&(cond), 0)
 #define X_COND_SIGNAL(cond)		pthread_cond_signal (&(cond))
+#define X_COND_BROADCAST(cond)		pthread_cond_broadcast (&(cond))
 #define X_COND_WAIT(cond,mutex)		pthread_cond_wait (&(cond), &(mutex))
 #define X_COND_TIMEDWAIT(cond,mutex,to)	pthread_cond_timedwait (&(cond), &(mutex), &(to))
+#define X_COND_DESTROY(cond)		pthread_cond_destroy (&(cond))
 
 typedef pthread_t xthread_t;
 #define X_THREAD_PROC(name) static void *name (void *thr_arg)